@@ -0,0 +1,52 @@
+#include <iostream>
+#include "../include/data.hh"
+
+ckflogs::Logger::Ptr _logger;
+
+/**
+ * 函数功能：显示程序使用帮助信息
+ * 输入参数：无
+ * 输出参数：无
+ * 返回值：无
+ * 调用关系：此函数在命令行参数不正确时被调用
+ */
+void usage()
+{
+    std::cout << "-------- USAGE --------" << std::endl;
+    std::cout << "./json2snap backup.json backup.snap" << std::endl;
+}
+
+/**
+ * 函数功能：主函数，把旧的Json备份文件离线转换为二进制快照
+ * 输入参数：argc - 命令行参数个数，argv - 命令行参数数组
+ * 输出参数：无
+ * 返回值：整数，程序的退出状态码，0表示成功，非0表示失败
+ * 调用关系：调用了Cloud::Snapshot::convertFromJson()
+ */
+int main(int argc, char *argv[])
+{
+    // 第一个参数：Json备份文件路径
+    // 第二个参数：二进制快照路径
+    if (argc != 3)
+    {
+        usage();
+        return -1;
+    }
+    std::string json(argv[1]);
+    std::string snap(argv[2]);
+
+    if (!Cloud::Snapshot::convertFromJson(json, snap))
+    {
+        std::cout << "转换失败" << std::endl;
+        return -1;
+    }
+
+    Cloud::Snapshot check(snap);
+    if (!check.open())
+    {
+        std::cout << "快照校验失败" << std::endl;
+        return -1;
+    }
+    std::cout << "转换完成，共 " << check.size() << " 条备份信息" << std::endl;
+    return 0;
+}
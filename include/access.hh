@@ -0,0 +1,164 @@
+#pragma once
+#include <cmath>
+#include <mutex>
+#include <algorithm>
+#include <unordered_map>
+#include <string_view>
+#include "util.hh"
+
+namespace Cloud
+{
+    // 访问热度跟踪：每个文件（按相对路径）一个指数衰减计数器
+    // 每次访问加一，经过一个半衰期热度减半，热度高的文件即使很久没有修改也不压缩，
+    // 避免频繁下载的文件在pack_dir与backup_dir之间来回压缩、解压
+    // 计数器以相对路径的哈希值为key，不保存路径本身，查找时不构造string；碰撞只会让两个文件共用热度
+    // 按哈希分片加锁；单个分片超过容量时先丢弃已衰减到接近0的计数器，仍超出则丢弃较冷的一半
+    class AccessTracker
+    {
+    public:
+        AccessTracker(unsigned halfLife, size_t capacity);
+
+        void touch(std::string_view rel, time_t now);        // 记录一次访问
+        double score(std::string_view rel, time_t now);      // 当前热度（衰减后）
+        time_t coolAt(std::string_view rel, double threshold, time_t now); // 热度衰减到threshold以下的时刻，已低于则返回now
+        void forget(std::string_view rel);                   // 删除、改名后不再跟踪
+        size_t size();
+
+    private:
+        struct Counter
+        {
+            double score; // 上次访问时的热度
+            time_t last;  // 上次访问时间
+        };
+
+        struct Shard
+        {
+            std::unordered_map<size_t, Counter> counters; // 相对路径的哈希 -> 计数器
+            std::mutex mutex;
+        };
+
+        static const size_t shard_num = 16;
+        static constexpr double min_score = 0.05; // 低于该值视为没有访问
+
+        static size_t hashOf(std::string_view rel);
+        Shard &shardOf(size_t h);
+        double decayed(const Counter &c, time_t now) const;
+        void evictLocked(Shard &shard, time_t now); // 容量超出时淘汰（调用者持有分片锁）
+
+    private:
+        double _half_life;       // 半衰期（秒）
+        size_t _shard_capacity;  // 单个分片的容量
+        Shard _shards[shard_num];
+    };
+}
+
+Cloud::AccessTracker::AccessTracker(unsigned halfLife, size_t capacity)
+    : _half_life(halfLife == 0 ? 1 : halfLife), _shard_capacity(capacity / shard_num + 1)
+{
+}
+
+size_t Cloud::AccessTracker::hashOf(std::string_view rel)
+{
+    return std::hash<std::string_view>()(rel);
+}
+
+Cloud::AccessTracker::Shard &Cloud::AccessTracker::shardOf(size_t h)
+{
+    return _shards[h % shard_num];
+}
+
+double Cloud::AccessTracker::decayed(const Counter &c, time_t now) const
+{
+    if (now <= c.last)
+        return c.score;
+    return c.score * std::exp2(-(double)(now - c.last) / _half_life);
+}
+
+void Cloud::AccessTracker::touch(std::string_view rel, time_t now)
+{
+    size_t h = hashOf(rel);
+    Shard &shard = shardOf(h);
+    std::unique_lock<std::mutex> lck(shard.mutex);
+
+    auto it = shard.counters.find(h);
+    if (it == shard.counters.end())
+    {
+        if (shard.counters.size() >= _shard_capacity)
+            evictLocked(shard, now);
+        shard.counters.emplace(h, Counter{1.0, now});
+        return;
+    }
+    it->second.score = decayed(it->second, now) + 1.0;
+    it->second.last = now;
+}
+
+double Cloud::AccessTracker::score(std::string_view rel, time_t now)
+{
+    size_t h = hashOf(rel);
+    Shard &shard = shardOf(h);
+    std::unique_lock<std::mutex> lck(shard.mutex);
+
+    auto it = shard.counters.find(h);
+    if (it == shard.counters.end())
+        return 0;
+    return decayed(it->second, now);
+}
+
+time_t Cloud::AccessTracker::coolAt(std::string_view rel, double threshold, time_t now)
+{
+    double s = score(rel, now);
+    if (s < threshold || threshold <= 0)
+        return now;
+    // s * 2^(-t / half_life) < threshold  =>  t > half_life * log2(s / threshold)
+    return now + (time_t)(_half_life * std::log2(s / threshold)) + 1;
+}
+
+void Cloud::AccessTracker::forget(std::string_view rel)
+{
+    size_t h = hashOf(rel);
+    Shard &shard = shardOf(h);
+    std::unique_lock<std::mutex> lck(shard.mutex);
+    shard.counters.erase(h);
+}
+
+size_t Cloud::AccessTracker::size()
+{
+    size_t n = 0;
+    for (size_t i = 0; i < shard_num; i++)
+    {
+        std::unique_lock<std::mutex> lck(_shards[i].mutex);
+        n += _shards[i].counters.size();
+    }
+    return n;
+}
+
+void Cloud::AccessTracker::evictLocked(Shard &shard, time_t now)
+{
+    // 1.丢弃已衰减到接近0的计数器
+    for (auto it = shard.counters.begin(); it != shard.counters.end();)
+    {
+        if (decayed(it->second, now) < min_score)
+            it = shard.counters.erase(it);
+        else
+            ++it;
+    }
+    if (shard.counters.size() < _shard_capacity)
+        return;
+
+    // 2.仍然超出：按当前热度丢弃较冷的一半
+    std::vector<double> scores;
+    scores.reserve(shard.counters.size());
+    for (auto &[h, c] : shard.counters)
+        scores.push_back(decayed(c, now));
+    auto mid = scores.begin() + scores.size() / 2;
+    std::nth_element(scores.begin(), mid, scores.end());
+    double cut = *mid;
+    size_t keep = _shard_capacity / 2;
+    for (auto it = shard.counters.begin(); it != shard.counters.end() && shard.counters.size() > keep;)
+    {
+        if (decayed(it->second, now) <= cut)
+            it = shard.counters.erase(it);
+        else
+            ++it;
+    }
+}
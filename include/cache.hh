@@ -0,0 +1,195 @@
+#pragma once
+#include <map>
+#include <list>
+#include <mutex>
+#include <future>
+#include "util.hh"
+#include "config.hh"
+#include "pack.hh"
+#include "metrics.hh"
+#include "threadpool.hh"
+
+namespace Cloud
+{
+    // 解压缓存：非热点文件下载时按块从压缩包解压到内存提供给响应，不再解压回backup_dir、改写元信息
+    // 缓存单位是压缩包中的一块，Range请求只解压与之重叠的块，首字节延迟与文件大小无关
+    // 按解压后的字节数限制容量，LRU淘汰；超过容量一半的块（旧格式的整个文件）不缓存，用完即释放
+    // 同一块同时被多个请求读取时只解压一次，其余请求等待同一份结果
+    // 压缩包被重新生成（大小或修改时间变化）后旧的缓存项自动失效
+    // 顺序下载时由prefetch在cpu执行器中预先解压下一块，解压与发送重叠
+    class PackCache
+    {
+    public:
+        using Data = std::shared_ptr<const std::string>;
+
+        static PackCache &getInstance(); // 获取单例对象
+
+        Data get(const PackReader &reader, size_t i); // 获取第i块解压后的内容，失败返回nullptr
+        // 在cpu执行器中预先解压第i块（已缓存、正在解压或放不进缓存时不做）；token被取消时尚未开始的预先解压直接丢弃
+        void prefetch(const std::shared_ptr<const PackReader> &reader, size_t i, const ckf::CancelToken &token);
+        void erase(const std::string &packPath);      // 压缩包删除、改名后丢弃它的所有块
+        size_t bytes();                               // 当前缓存的字节数
+
+    private:
+        PackCache(size_t capacity);
+        PackCache(const PackCache &other) = delete;
+        PackCache &operator=(const PackCache &other) = delete;
+
+        using Key = std::pair<std::string, size_t>; // (压缩包路径, 块号)
+
+        struct Version // 用于判断压缩包是否被重新生成
+        {
+            time_t mtime;
+            uint64_t size;
+            bool operator==(const Version &other) const { return mtime == other.mtime && size == other.size; }
+        };
+
+        struct Entry
+        {
+            Data data;
+            Version version;
+            std::list<Key>::iterator lru; // 在_lru中的位置
+        };
+
+        void insertLocked(const Key &key, const Version &version, const Data &data);
+        void eraseLocked(std::map<Key, Entry>::iterator it);
+
+    private:
+        size_t _capacity;                                 // 容量（解压后的字节数）
+        size_t _bytes;                                    // 已缓存的字节数
+        std::map<Key, Entry> _entries;                    // 按压缩包路径有序，便于整体丢弃
+        std::list<Key> _lru;                              // 表头最近使用
+        std::map<Key, std::shared_future<Data>> _loading; // 正在解压的块
+        std::mutex _mutex;
+        Counter &_hits;        // 命中缓存的块
+        Counter &_misses;      // 解压的块（每次未命中即一次解压）
+        Counter &_unpacked;    // 解压出的字节数
+        Counter &_prefetched;  // 提交的预先解压
+    };
+}
+
+Cloud::PackCache &Cloud::PackCache::getInstance()
+{
+    static PackCache inst(Config::getInstance()->getPackCacheSize());
+    return inst;
+}
+
+Cloud::PackCache::PackCache(size_t capacity)
+    : _capacity(capacity), _bytes(0),
+      _hits(Metrics::getInstance().counter("cloud_pack_cache_hits_total", "Pack blocks served from the cache")),
+      _misses(Metrics::getInstance().counter("cloud_pack_cache_misses_total", "Pack blocks decompressed on demand")),
+      _unpacked(Metrics::getInstance().counter("cloud_pack_unpacked_bytes_total", "Bytes decompressed for downloads")),
+      _prefetched(Metrics::getInstance().counter("cloud_pack_prefetch_total", "Pack blocks scheduled for read-ahead decompression"))
+{
+    Metrics::getInstance().gauge("cloud_pack_cache_bytes", "Decompressed bytes held by the pack cache", [this]()
+                                 { return (double)bytes(); });
+}
+
+Cloud::PackCache::Data Cloud::PackCache::get(const PackReader &reader, size_t i)
+{
+    Version version{reader.mtime(), reader.packSize()};
+    Key key(reader.path(), i);
+
+    std::shared_future<Data> loading;
+    {
+        std::unique_lock<std::mutex> lck(_mutex);
+        // 1.命中：移到表头
+        auto it = _entries.find(key);
+        if (it != _entries.end())
+        {
+            if (it->second.version == version)
+            {
+                _hits.inc();
+                _lru.splice(_lru.begin(), _lru, it->second.lru);
+                return it->second.data;
+            }
+            eraseLocked(it); // 压缩包已被重新生成
+        }
+
+        // 2.未命中：已有请求在解压则等待它，否则由当前请求解压
+        auto lit = _loading.find(key);
+        if (lit != _loading.end())
+        {
+            _hits.inc(); // 与正在进行的解压共享结果
+            loading = lit->second;
+        }
+        else
+        {
+            std::promise<Data> promise;
+            loading = promise.get_future().share();
+            _loading.emplace(key, loading);
+            lck.unlock();
+
+            auto raw = std::make_shared<std::string>();
+            Data data = reader.readBlock(i, raw.get()) ? raw : nullptr;
+            promise.set_value(data);
+            _misses.inc();
+            if (data)
+                _unpacked.inc(data->size());
+
+            lck.lock();
+            _loading.erase(key);
+            if (data && data->size() <= _capacity / 2)
+                insertLocked(key, version, data);
+            return data;
+        }
+    }
+    return loading.get();
+}
+
+void Cloud::PackCache::prefetch(const std::shared_ptr<const PackReader> &reader, size_t i, const ckf::CancelToken &token)
+{
+    if (i >= reader->blocks())
+        return;
+    // 放不进缓存的块预先解压也会被丢弃
+    uint64_t len = (i + 1 < reader->blocks() ? reader->blockOffset(i + 1) : reader->size()) - reader->blockOffset(i);
+    if (len > _capacity / 2)
+        return;
+    {
+        std::unique_lock<std::mutex> lck(_mutex);
+        Key key(reader->path(), i);
+        auto it = _entries.find(key);
+        if ((it != _entries.end() && it->second.version == Version{reader->mtime(), reader->packSize()}) || _loading.count(key))
+            return;
+    }
+    // 预先解压是推测性的：优先级最低，停止时直接丢弃
+    if (ckf::ThreadPool::getInstance(ckf::ThreadPool::CPU).post(ckf::ThreadPool::LV3, token, [this, reader, i]()
+                                                                 { get(*reader, i); }))
+        _prefetched.inc();
+}
+
+void Cloud::PackCache::erase(const std::string &packPath)
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    auto it = _entries.lower_bound(Key(packPath, 0));
+    while (it != _entries.end() && it->first.first == packPath)
+        eraseLocked(it++);
+}
+
+size_t Cloud::PackCache::bytes()
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    return _bytes;
+}
+
+void Cloud::PackCache::insertLocked(const Key &key, const Version &version, const Data &data)
+{
+    auto it = _entries.find(key);
+    if (it != _entries.end())
+        eraseLocked(it);
+
+    // 淘汰最久未使用的项，直到放得下
+    while (!_lru.empty() && _bytes + data->size() > _capacity)
+        eraseLocked(_entries.find(_lru.back()));
+
+    _lru.push_front(key);
+    _entries.emplace(key, Entry{data, version, _lru.begin()});
+    _bytes += data->size();
+}
+
+void Cloud::PackCache::eraseLocked(std::map<Key, Entry>::iterator it)
+{
+    _bytes -= it->second.data->size();
+    _lru.erase(it->second.lru);
+    _entries.erase(it);
+}
@@ -0,0 +1,582 @@
+#pragma once
+#include <cmath>
+#include <map>
+#include <set>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "util.hh"
+#include "config.hh"
+#include "threadpool.hh"
+#include "data.hh"
+#include "pack.hh"
+#include "metrics.hh"
+
+extern ckflogs::Logger::Ptr _logger;
+
+namespace Cloud
+{
+    // 压缩调度器：非热点文件的压缩不再作为同等的线程池任务逐个整体压缩
+    // 1.按大小和等待时间排序：小文件、早冷却的文件先压缩，文件大小每翻一倍相当于晚冷却aging_period秒，
+    //   大文件不会被源源不断的小文件饿死
+    // 2.文件切成pack_chunk_size大小的块，各块作为任务交给background执行器并行压缩，按块号顺序写入压缩包；
+    //   每个文件同时在处理的块数不超过窗口大小；所有文件已读入、尚未写出的块合计不超过stream_window，
+    //   原文件按块pread、压缩包按块追加，峰值内存约为stream_window的两倍（原始数据 + 压缩结果），与文件大小无关
+    // 3.压缩算法：先抽样文件开头的sample_size字节试压缩，节省不到10%的文件不压缩（codec记为CODEC_SKIP），
+    //   字节熵接近8的抽样只试最快的LZ4；否则按codec_policy在LZ4/ZSTD/LZIP中选择：
+    //   speed只用LZ4，ratio取压缩率最高者，balanced取压缩后大小不超过最优者5%的算法中最快的；
+    //   抽样覆盖了整个第一块时，试压缩的结果直接作为第一块写出
+    // 4.CPU预算：compress_cpu为可用于压缩的CPU核数比例，同时执行的压缩任务数按预算取整（不超过执行器的线程数），
+    //   不足一个核时按实际消耗的CPU时间休眠；background执行器的线程降低了调度优先级，不与请求处理抢占CPU
+    // 5.停止：shutdown不再接受新文件，在期限内等待正在压缩的文件完成；仍未完成的删除临时压缩包，
+    //   回调报告失败（原文件还在backup_dir，下次启动后重新调度）
+    class Compressor
+    {
+    public:
+        using Done = std::function<void(const BackupInfo &bi, bool ok)>; // 压缩结束（在工作线程中调用），bi.codec为选定的算法或CODEC_SKIP
+
+        static Compressor &getInstance(); // 获取单例对象
+
+        void submit(const BackupInfo &bi, Done done); // 提交一个文件（realPath -> packPath），停止后直接回调失败
+        size_t pending();                             // 等待或正在压缩的文件数
+        bool shutdown(std::chrono::milliseconds timeout); // 有序停止，期限内全部完成返回true
+
+    private:
+        Compressor();
+        ~Compressor();
+        Compressor(const Compressor &other) = delete;
+        Compressor &operator=(const Compressor &other) = delete;
+
+        struct Job
+        {
+            BackupInfo bi;
+            Done done;
+            double rank;                       // 排序键，越小越先压缩
+            int fd = -1;                       // 原文件
+            uint32_t src_mtime_ns = 0;         // 原文件修改时间的纳秒部分（写入压缩包头部）
+            size_t chunks = 0;                 // 总块数
+            size_t next = 0;                   // 下一个分配给压缩任务的块号
+            size_t written = 0;                // 已写入压缩包的块数
+            size_t running = 0;                // 正在压缩的块数
+            bool sampled = false;              // 是否已抽样选定压缩算法
+            bool queued = false;               // 是否在队列中
+            bool writing = false;              // 是否有工作线程正在写出（同一时刻只有一个）
+            bool failed = false;
+            bool finished = false;
+            std::map<size_t, std::pair<Pack::Block, std::string>> ready; // 已压缩、等待按序写出的块
+            std::unique_ptr<PackWriter> writer;
+            std::chrono::steady_clock::time_point start; // 开始抽样的时刻，用于统计吞吐
+        };
+        using JobPtr = std::shared_ptr<Job>;
+
+        struct JobCompare
+        {
+            bool operator()(const JobPtr &a, const JobPtr &b) const { return a->rank > b->rank; }
+        };
+
+        static const time_t aging_period = 3600;      // 等待该时长相当于文件大小减半
+        static constexpr size_t sample_size = 1024 * 1024; // 抽样长度
+        static constexpr size_t sample_idx = (size_t)-1;   // 表示抽样任务的块号
+
+        void spawnLocked();                        // 有可取的块时按预算提交压缩任务（调用者持有_mutex）
+        void runTask();                            // 压缩任务：取出并处理一块
+        bool takeLocked(JobPtr *job, size_t *idx); // 取出下一块（调用者持有_mutex）
+        void requeueLocked(const JobPtr &job);     // 还有可分配的块且窗口未满时放回队列
+        void releaseLocked(size_t n);              // n块写出或丢弃，内存窗口有了空位
+        bool readRange(const JobPtr &job, size_t offset, size_t len, std::string *raw);
+        void sample(const JobPtr &job);                // 抽样并选择压缩算法（每个文件一次，在第一块之前）
+        unsigned selectCodec(const std::string &sample, Pack::Block *block, std::string *data); // 返回选定的算法或CODEC_SKIP
+        static double entropy(const std::string &data); // 字节熵（bit/字节）
+        void compressChunk(const JobPtr &job, size_t idx);
+        void commitChunk(const JobPtr &job, size_t idx, bool ok, const Pack::Block &block, std::string data); // 按块号顺序写出
+        void finish(const JobPtr &job);            // 全部写出或失败后收尾（不持锁）
+        void record(const JobPtr &job, bool ok);   // 记录压缩结果、吞吐和压缩率指标
+        void throttle(double cpuSeconds);          // 按CPU预算休眠
+        void retireLocked(const JobPtr &job);      // 文件处理结束，不再计入未完成数（调用者持有_mutex）
+
+    private:
+        size_t _chunk_size; // 块大小
+        std::string _policy; // 压缩算法选择策略：speed/balanced/ratio
+        size_t _window;     // 每个文件同时在处理的块数上限
+        size_t _max_inflight; // 所有文件已读入、尚未写出或丢弃的块数上限（stream_window / 块大小）
+        size_t _inflight;   // 已读入、尚未写出或丢弃的块数
+        double _share;      // 每个压缩任务可用的CPU比例（不超过1）
+        std::priority_queue<JobPtr, std::vector<JobPtr>, JobCompare> _queue;
+        size_t _jobs;       // 未完成的文件数
+        std::set<JobPtr> _live; // 未完成的文件（不论是否在队列中），停止时逐个放弃
+        ckf::ThreadPool &_pool; // background执行器
+        size_t _workers;    // 同时执行的压缩任务数上限
+        size_t _tasks;      // 已提交、尚未结束的压缩任务数
+        std::mutex _mutex;
+        std::condition_variable _cond; // 压缩任务数归零
+        std::condition_variable _idle; // 未完成的文件数归零
+        bool _running;
+        bool _accepting;    // 是否接受新文件
+    };
+}
+
+Cloud::Compressor &Cloud::Compressor::getInstance()
+{
+    static Compressor inst;
+    return inst;
+}
+
+Cloud::Compressor::Compressor()
+    : _inflight(0), _jobs(0), _pool(ckf::ThreadPool::getInstance(ckf::ThreadPool::BACKGROUND)), _tasks(0),
+      _running(true), _accepting(true)
+{
+    Config *conf = Config::getInstance();
+    _chunk_size = conf->getPackChunkSize();
+    _policy = conf->getCodecPolicy();
+
+    double cores = std::thread::hardware_concurrency() * conf->getCompressCpu();
+    _workers = std::min(_pool.size(), std::max<size_t>(1, (size_t)std::ceil(cores)));
+    _share = std::min(1.0, cores / _workers);
+    _max_inflight = std::max<size_t>(1, conf->getStreamWindow() / _chunk_size);
+    _window = std::min(2 * _workers, _max_inflight);
+
+    Metrics &m = Metrics::getInstance();
+    m.gauge("cloud_compress_queue_depth", "Files waiting for or under compression", [this]()
+            { return (double)pending(); });
+    m.gauge("cloud_compress_inflight_chunks", "Chunks read but not yet written to a pack", [this]()
+            { std::unique_lock<std::mutex> lck(_mutex); return (double)_inflight; });
+
+    _logger->_info("压缩调度器启动, 并行任务 %d 个, CPU预算 %.2f 核, 内存窗口 %d 块", (int)_workers, cores, (int)_max_inflight);
+}
+
+Cloud::Compressor::~Compressor()
+{
+    // 没有经过shutdown（进程直接退出）：只等待正在执行的压缩任务结束，不再回调（元信息模块可能已析构）
+    // background执行器在本对象的构造函数中创建，析构晚于本对象，排队的任务仍会执行并立即返回
+    std::unique_lock<std::mutex> lck(_mutex);
+    _running = false;
+    _accepting = false;
+    _cond.wait(lck, [this]()
+               { return _tasks == 0; });
+}
+
+bool Cloud::Compressor::shutdown(std::chrono::milliseconds timeout)
+{
+    // 1.不再接受新文件，等待已提交的文件压缩完成
+    std::unique_lock<std::mutex> lck(_mutex);
+    _accepting = false;
+    bool drained = _idle.wait_for(lck, timeout, [this]()
+                                  { return _jobs == 0; });
+
+    // 2.不再提交压缩任务，等待已提交的任务结束（正在压缩的块完成，排队的直接返回）
+    _running = false;
+    _cond.wait(lck, [this]()
+               { return _tasks == 0; });
+
+    // 3.放弃仍未完成的文件：关闭原文件、删除临时压缩包、回调失败
+    std::vector<JobPtr> left(_live.begin(), _live.end());
+    for (const JobPtr &job : left)
+    {
+        job->failed = true;
+        job->finished = true;
+        releaseLocked(job->ready.size());
+        job->ready.clear();
+        retireLocked(job);
+    }
+    _queue = decltype(_queue)();
+    lck.unlock();
+    for (const JobPtr &job : left)
+        finish(job);
+
+    if (!left.empty())
+        _logger->_warn("压缩调度器停止, 放弃未完成的文件 %d 个", (int)left.size());
+    return drained;
+}
+
+void Cloud::Compressor::retireLocked(const JobPtr &job)
+{
+    _live.erase(job);
+    if (--_jobs == 0)
+        _idle.notify_all();
+}
+
+void Cloud::Compressor::submit(const BackupInfo &bi, Done done)
+{
+    auto job = std::make_shared<Job>();
+    job->bi = bi;
+    job->done = std::move(done);
+    job->rank = std::log2((double)bi.fsize + 1) + (double)bi.coldTime() / aging_period;
+    job->chunks = std::max<size_t>(1, (bi.fsize + _chunk_size - 1) / _chunk_size);
+
+    std::string realPath = bi.realPath();
+    job->fd = ::open(realPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (job->fd < 0)
+    {
+        _logger->_warn("压缩任务创建失败: %s", realPath.c_str());
+        job->done(job->bi, false);
+        return;
+    }
+    struct stat st;
+    if (::fstat(job->fd, &st) == 0)
+        job->src_mtime_ns = st.st_mtim.tv_nsec;
+
+    std::unique_lock<std::mutex> lck(_mutex);
+    if (!_accepting)
+    {
+        lck.unlock();
+        ::close(job->fd);
+        job->done(job->bi, false);
+        return;
+    }
+    _jobs++;
+    _live.insert(job);
+    requeueLocked(job);
+}
+
+size_t Cloud::Compressor::pending()
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    return _jobs;
+}
+
+void Cloud::Compressor::spawnLocked()
+{
+    // 每个任务只处理一块，结束时再检查是否还有可取的块：同一执行器中的其它任务也能轮到，不会被压缩长期占满
+    while (_running && _tasks < _workers && !_queue.empty() && _inflight < _max_inflight)
+    {
+        if (!_pool.post(ckf::ThreadPool::LV2, [this]()
+                        { runTask(); }))
+            break;
+        _tasks++;
+    }
+}
+
+void Cloud::Compressor::runTask()
+{
+    JobPtr job;
+    size_t idx;
+    {
+        std::unique_lock<std::mutex> lck(_mutex);
+        if (!_running || !takeLocked(&job, &idx))
+        {
+            if (--_tasks == 0)
+                _cond.notify_all();
+            return;
+        }
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t0);
+    if (idx == sample_idx)
+        sample(job);
+    else
+        compressChunk(job, idx);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t1);
+    throttle((t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+
+    std::unique_lock<std::mutex> lck(_mutex);
+    if (--_tasks == 0)
+        _cond.notify_all();
+    spawnLocked();
+}
+
+bool Cloud::Compressor::takeLocked(JobPtr *job, size_t *idx)
+{
+    // 内存窗口已满：等已读入的块写出后再取（每个文件最早未写出的块总在压缩或写出中，不会互相等待）
+    while (!_queue.empty() && _inflight < _max_inflight)
+    {
+        JobPtr top = _queue.top();
+        _queue.pop();
+        top->queued = false;
+        if (top->failed || top->finished)
+            continue;
+
+        *job = top;
+        top->running++;
+        _inflight++;
+        if (!top->sampled)
+        {
+            *idx = sample_idx; // 抽样结束之前不分配其它块
+            return true;
+        }
+        *idx = top->next++;
+        requeueLocked(top); // 其余的块由其它压缩任务并行压缩
+        return true;
+    }
+    return false;
+}
+
+void Cloud::Compressor::requeueLocked(const JobPtr &job)
+{
+    if (job->queued || job->failed || (!job->sampled && job->running > 0) ||
+        job->next >= job->chunks || job->next - job->written >= _window)
+        return;
+    job->queued = true;
+    _queue.push(job);
+    spawnLocked();
+}
+
+void Cloud::Compressor::releaseLocked(size_t n)
+{
+    if (n == 0)
+        return;
+    bool full = _inflight >= _max_inflight;
+    _inflight -= n;
+    if (full) // 因窗口已满而没有提交的任务
+        spawnLocked();
+}
+
+bool Cloud::Compressor::readRange(const JobPtr &job, size_t offset, size_t len, std::string *raw)
+{
+    raw->resize(len);
+    size_t got = 0;
+    while (got < len)
+    {
+        ssize_t n = ::pread(job->fd, &(*raw)[got], len - got, offset + got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        got += n;
+    }
+    if (got != len)
+    {
+        _logger->_warn("读取文件失败(文件已被截断?): %s", job->bi.realPath().c_str());
+        return false;
+    }
+    return true;
+}
+
+void Cloud::Compressor::sample(const JobPtr &job)
+{
+    // 1.抽样开头的sample_size字节（不超过第一块），选择压缩算法
+    job->start = std::chrono::steady_clock::now();
+    size_t first = std::min(_chunk_size, job->bi.fsize);
+    size_t len = std::min(sample_size, first);
+    std::string raw, data;
+    Pack::Block block;
+    bool ok = readRange(job, 0, len, &raw);
+    unsigned codec = ok ? selectCodec(raw, &block, &data) : BackupInfo::CODEC_SKIP;
+
+    // 2.不可压缩：不生成压缩包，文件留在backup_dir
+    if (ok && codec == BackupInfo::CODEC_SKIP)
+    {
+        std::unique_lock<std::mutex> lck(_mutex);
+        job->running--;
+        job->finished = true;
+        job->bi.codec = BackupInfo::CODEC_SKIP;
+        retireLocked(job);
+        releaseLocked(1);
+        lck.unlock();
+        _logger->_debug("文件不可压缩, 跳过: %s", job->bi.realPath().c_str());
+        finish(job);
+        return;
+    }
+
+    // 3.创建压缩包，头部记录选定的算法
+    if (ok)
+    {
+        job->writer.reset(new PackWriter(job->bi.packPath()));
+        ok = job->writer->open(_chunk_size, job->bi.fsize, codec, job->src_mtime_ns);
+    }
+
+    std::unique_lock<std::mutex> lck(_mutex);
+    job->sampled = true;
+    job->bi.codec = codec;
+    if (ok && len == first)
+    {
+        // 抽样覆盖了整个第一块：试压缩的结果就是第一块
+        job->next = 1;
+        lck.unlock();
+        commitChunk(job, 0, true, block, std::move(data));
+        return;
+    }
+    lck.unlock();
+    commitChunk(job, sample_idx, ok, block, std::string());
+}
+
+unsigned Cloud::Compressor::selectCodec(const std::string &sample, Pack::Block *block, std::string *data)
+{
+    // 1.太小：不值得压缩
+    if (sample.size() < 64)
+        return BackupInfo::CODEC_SKIP;
+
+    // 2.试压缩候选算法，记录大小和耗时；speed只试LZ4，
+    //   字节熵接近8的数据（已压缩的图片、视频、压缩包等）也只用最快的LZ4确认一下（字节分布均匀的数据仍可能有重复串）
+    struct Trial
+    {
+        unsigned codec;
+        Pack::Block block;
+        std::string data;
+        double seconds;
+    };
+    std::vector<Trial> trials;
+    std::vector<unsigned> candidates = {bundle::LZ4, bundle::ZSTD, bundle::LZIP}; // 由快到慢
+    if (_policy == "speed" || entropy(sample) > 7.9)
+        candidates.resize(1);
+    for (unsigned codec : candidates)
+    {
+        Trial t;
+        t.codec = codec;
+        auto begin = std::chrono::steady_clock::now();
+        t.data = Pack::compressBlock(sample, codec, &t.block);
+        t.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        if (!(t.block.flags & Pack::FLAG_STORED))
+            trials.push_back(std::move(t));
+    }
+
+    // 3.节省不到10%：不可压缩
+    size_t best = sample.size();
+    for (const Trial &t : trials)
+        best = std::min<size_t>(best, t.block.z_len);
+    if (trials.empty() || best > sample.size() * 0.9)
+        return BackupInfo::CODEC_SKIP;
+
+    // 4.按策略选择：ratio取最小，其余取大小不超过最优者5%的算法中最快的
+    Trial *chosen = nullptr;
+    for (Trial &t : trials)
+    {
+        if (_policy == "ratio")
+        {
+            if (t.block.z_len == best)
+                chosen = &t;
+        }
+        else if (t.block.z_len <= best * 1.05 && (!chosen || t.seconds < chosen->seconds))
+            chosen = &t;
+    }
+    *block = chosen->block;
+    *data = std::move(chosen->data);
+    _logger->_debug("抽样 %d 字节, 选择压缩算法 %s, 压缩率 %.2f", (int)sample.size(), bundle::name_of(chosen->codec),
+                    (double)chosen->block.z_len / sample.size());
+    return chosen->codec;
+}
+
+double Cloud::Compressor::entropy(const std::string &data)
+{
+    size_t count[256] = {0};
+    for (unsigned char c : data)
+        count[c]++;
+    double h = 0;
+    for (size_t n : count)
+    {
+        if (n == 0)
+            continue;
+        double p = (double)n / data.size();
+        h -= p * std::log2(p);
+    }
+    return h;
+}
+
+void Cloud::Compressor::compressChunk(const JobPtr &job, size_t idx)
+{
+    // 1.读取并压缩一块（不持锁）
+    size_t offset = idx * _chunk_size;
+    size_t len = std::min(_chunk_size, job->bi.fsize - std::min(job->bi.fsize, offset));
+    std::string raw, data;
+    Pack::Block block;
+    bool ok = readRange(job, offset, len, &raw);
+    if (ok)
+        data = Pack::compressBlock(raw, job->bi.codec, &block);
+    commitChunk(job, idx, ok, block, std::move(data));
+}
+
+void Cloud::Compressor::commitChunk(const JobPtr &job, size_t idx, bool ok, const Pack::Block &block, std::string data)
+{
+    // 2.按块号顺序写出已压缩的块：同一时刻只有一个工作线程写出，写盘时不持锁
+    std::unique_lock<std::mutex> lck(_mutex);
+    job->running--;
+    if (!ok)
+        job->failed = true;
+    if (ok && !job->failed && idx != sample_idx)
+        job->ready.emplace(idx, std::make_pair(block, std::move(data))); // 写出之前仍占用内存窗口
+    else
+        releaseLocked(1);
+
+    while (!job->writing && !job->failed && !job->ready.empty() && job->ready.begin()->first == job->written)
+    {
+        std::vector<std::pair<Pack::Block, std::string>> blocks;
+        for (auto it = job->ready.begin(); it != job->ready.end() && it->first == job->written + blocks.size();)
+        {
+            blocks.push_back(std::move(it->second));
+            it = job->ready.erase(it);
+        }
+        job->writing = true;
+        lck.unlock();
+
+        bool written = true;
+        for (auto &[head, bytes] : blocks)
+        {
+            if (!(written = job->writer->append(head, bytes)))
+                break;
+        }
+
+        lck.lock();
+        job->writing = false;
+        releaseLocked(blocks.size());
+        if (!written)
+            job->failed = true;
+        else
+            job->written += blocks.size();
+    }
+    requeueLocked(job); // 写出后窗口有了空位
+
+    // 3.全部写出，或失败且没有块还在压缩：收尾
+    bool done = !job->finished && !job->writing &&
+                ((job->failed && job->running == 0) || job->written == job->chunks);
+    if (!done)
+        return;
+    job->finished = true;
+    releaseLocked(job->ready.size()); // 失败时丢弃尚未写出的块
+    job->ready.clear();
+    retireLocked(job);
+    lck.unlock();
+    finish(job);
+}
+
+void Cloud::Compressor::finish(const JobPtr &job)
+{
+    ::close(job->fd);
+    bool ok = !job->failed;
+    if (job->writer)
+    {
+        ok = ok && job->writer->finish();
+        if (!ok)
+            job->writer->abort();
+    }
+    record(job, ok);
+    job->done(job->bi, ok);
+}
+
+void Cloud::Compressor::record(const JobPtr &job, bool ok)
+{
+    Metrics &m = Metrics::getInstance();
+    const char *result = !ok ? "failed" : (job->bi.codec == BackupInfo::CODEC_SKIP ? "skipped" : "ok");
+    m.counter("cloud_compress_files_total", "Compression jobs by result", Metrics::label("result", result)).inc();
+    if (!ok || !job->writer)
+        return;
+
+    // 按压缩算法分别统计：原始字节、压缩包字节、每个文件的耗时、吞吐和压缩率
+    std::string codec = Metrics::label("codec", bundle::name_of((unsigned)job->bi.codec));
+    uint64_t raw = job->bi.fsize, packed = job->writer->size();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - job->start).count();
+    m.counter("cloud_compress_raw_bytes_total", "Bytes read from compressed files", codec).inc(raw);
+    m.counter("cloud_compress_packed_bytes_total", "Bytes written to packs", codec).inc(packed);
+    m.counter("cloud_compress_saved_bytes_total", "Bytes saved by compression", codec).inc(raw > packed ? raw - packed : 0);
+    m.histogram("cloud_compress_seconds", "Wall time to compress one file",
+                {0.01, 0.05, 0.1, 0.5, 1, 5, 10, 30, 60, 300}, codec).observe(seconds);
+    if (seconds > 0)
+        m.histogram("cloud_compress_throughput_mbps", "Compression throughput per file (MB/s of input)",
+                    {1, 5, 10, 25, 50, 100, 200, 500, 1000}, codec).observe(raw / 1048576.0 / seconds);
+    if (raw > 0)
+        m.histogram("cloud_compress_ratio", "Pack size divided by original size per file",
+                    {0.05, 0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.8, 0.9, 1}, codec).observe((double)packed / raw);
+
+    _logger->_debug("文件压缩完成: %s, %s, %.2fs, %lu -> %lu", job->bi.realPath().c_str(),
+                    bundle::name_of((unsigned)job->bi.codec), seconds, (unsigned long)raw, (unsigned long)packed);
+}
+
+void Cloud::Compressor::throttle(double cpuSeconds)
+{
+    // 每个压缩任务只能使用_share比例的CPU：压缩用了t秒，就休眠t * (1 / _share - 1)秒
+    if (_share >= 1.0 || cpuSeconds <= 0)
+        return;
+    double pause = cpuSeconds * (1.0 / _share - 1.0);
+    std::this_thread::sleep_for(std::chrono::microseconds((long)(pause * 1e6)));
+}
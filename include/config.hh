@@ -3,11 +3,22 @@
 #include "log/ckflog.hpp"
 #include <iostream>
 #include <mutex>
+#include <map>
+#include <vector>
+#include <sched.h>
 
 #define CONFIG_FILE "../config/cloud.conf"
 
 namespace Cloud
 {
+    // 执行器（命名线程池）配置
+    struct ExecutorConf
+    {
+        size_t threads = 0;    // 工作线程数，0表示按默认值
+        int nice = 0;          // 工作线程的调度优先级（nice值）
+        std::vector<int> cpus; // 绑定的CPU，空表示不绑定
+    };
+
     class Config
     {
     private:
@@ -15,6 +26,8 @@ namespace Cloud
         static std::mutex _mutex;
         Config();
         bool readConfigFile();
+        bool readExecutor(const Json::Value &conf, const std::string &name, const ExecutorConf &def);
+        static bool parseCpuList(const std::string &list, std::vector<int> *cpus); // 形如"0-3,6"
 
     private:
         time_t _hot_time;          // 热点判断时间
@@ -24,7 +37,27 @@ namespace Cloud
         std::string _pack_dir;     // 服务端压缩文件存储目录
         std::string _svr_ip;       // 服务端ip地址
         unsigned _svr_port;        // 服务端端口号
-        std::string _manager_file; // 备份信息
+        std::string _manager_file; // 备份信息（旧的Json格式，启动时转换为二进制快照）
+        std::string _snapshot_file; // 备份信息二进制快照
+        std::string _journal_file; // 备份信息追加日志
+        size_t _compact_threshold; // 日志记录数达到该值时压实为快照
+        std::string _durability;   // 元信息持久化模式：sync / group / async
+        unsigned _flush_interval;  // 后台刷盘间隔（毫秒）
+        size_t _flush_batch;       // 待刷盘修改数达到该值时立即刷盘
+        std::string _meta_backend; // 元信息存储后端：journal / lsm
+        std::string _meta_dir;     // lsm后端的数据目录
+        size_t _max_segments;      // lsm后端段数超过该值时归并
+        std::string _trash_dir;    // 已删除文件的暂存目录，由后台任务回收
+        unsigned _access_half_life; // 访问热度的半衰期（秒）
+        double _hot_score;         // 访问热度不低于该值的文件不压缩
+        size_t _access_capacity;   // 最多跟踪的文件数
+        size_t _pack_cache_size;   // 解压缓存的容量（字节）
+        size_t _pack_chunk_size;   // 压缩包的块大小（字节）
+        double _compress_cpu;      // 可用于压缩的CPU核数比例
+        std::string _codec_policy; // 压缩算法选择策略：speed/balanced/ratio
+        size_t _stream_window;     // 压缩时同时在内存中的数据量上限（字节）
+        std::map<std::string, ExecutorConf> _executors; // 执行器名 -> 配置（io/cpu/background）
+        unsigned _shutdown_timeout; // 停止时等待已提交任务完成的最长时间（秒）
 
     public:
         time_t getHotTime() const;
@@ -35,6 +68,26 @@ namespace Cloud
         std::string getSvrIP() const;
         unsigned getSvrPort() const;
         std::string getManagerFile() const;
+        std::string getSnapshotFile() const;
+        std::string getJournalFile() const;
+        size_t getCompactThreshold() const;
+        std::string getDurability() const;
+        unsigned getFlushInterval() const;
+        size_t getFlushBatch() const;
+        std::string getMetaBackend() const;
+        std::string getMetaDir() const;
+        size_t getMaxSegments() const;
+        std::string getTrashDir() const;
+        unsigned getAccessHalfLife() const;
+        double getHotScore() const;
+        size_t getAccessCapacity() const;
+        size_t getPackCacheSize() const;
+        size_t getPackChunkSize() const;
+        double getCompressCpu() const;
+        std::string getCodecPolicy() const;
+        size_t getStreamWindow() const;
+        ExecutorConf getExecutor(const std::string &name) const;
+        unsigned getShutdownTimeout() const;
 
     public:
         static Config *getInstance();
@@ -81,6 +134,109 @@ bool Cloud::Config::readConfigFile()
     _svr_ip = conf["svr_ip"].asString();
     _svr_port = conf["svr_port"].asUInt();
     _manager_file = conf["manager_file"].asString();
+    _snapshot_file = conf.get("snapshot_file", "./backup.snap").asString();
+    _journal_file = conf.get("journal_file", _manager_file + ".journal").asString();
+    _compact_threshold = conf.get("compact_threshold", 10000).asUInt();
+    _durability = conf.get("durability", "group").asString();
+    _flush_interval = conf.get("flush_interval_ms", 10).asUInt();
+    _flush_batch = conf.get("flush_batch", 256).asUInt();
+    _meta_backend = conf.get("meta_backend", "journal").asString();
+    _meta_dir = conf.get("meta_dir", "./meta/").asString();
+    _max_segments = conf.get("max_segments", 8).asUInt();
+    _trash_dir = conf.get("trash_dir", "./trash/").asString();
+    _access_half_life = conf.get("access_half_life", 3600).asUInt();
+    _hot_score = conf.get("hot_score", 3.0).asDouble();
+    _access_capacity = conf.get("access_capacity", 100000).asUInt();
+    _pack_cache_size = conf.get("pack_cache_size", 64 * 1024 * 1024).asUInt64();
+    _pack_chunk_size = conf.get("pack_chunk_size", 4 * 1024 * 1024).asUInt();
+    _compress_cpu = conf.get("compress_cpu", 0.5).asDouble();
+    _codec_policy = conf.get("codec_policy", "balanced").asString();
+    _stream_window = conf.get("stream_window", 64 * 1024 * 1024).asUInt64();
+    ExecutorConf io, cpu, background;
+    background.nice = 10; // 压缩等后台工作不与请求处理抢占CPU
+    if (!readExecutor(conf, "io", io) || !readExecutor(conf, "cpu", cpu) || !readExecutor(conf, "background", background))
+        return false;
+    _shutdown_timeout = conf.get("shutdown_timeout", 30).asUInt();
+    if (_durability != "sync" && _durability != "group" && _durability != "async")
+    {
+        DF_ERROR("Config file - invalid durability: %s", _durability.c_str());
+        return false;
+    }
+    if (_pack_chunk_size < 64 * 1024)
+    {
+        DF_ERROR("Config file - pack_chunk_size too small: %d", (int)_pack_chunk_size);
+        return false;
+    }
+    if (_compress_cpu <= 0 || _compress_cpu > 1)
+    {
+        DF_ERROR("Config file - compress_cpu must be in (0, 1]: %f", _compress_cpu);
+        return false;
+    }
+    if (_codec_policy != "speed" && _codec_policy != "balanced" && _codec_policy != "ratio")
+    {
+        DF_ERROR("Config file - invalid codec_policy: %s", _codec_policy.c_str());
+        return false;
+    }
+    if (_stream_window < _pack_chunk_size)
+    {
+        DF_ERROR("Config file - stream_window smaller than pack_chunk_size: %lu", (unsigned long)_stream_window);
+        return false;
+    }
+    if (_meta_backend != "journal" && _meta_backend != "lsm")
+    {
+        DF_ERROR("Config file - invalid meta_backend: %s", _meta_backend.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool Cloud::Config::readExecutor(const Json::Value &conf, const std::string &name, const ExecutorConf &def)
+{
+    // "executors" : {"io" : {"threads" : 4, "nice" : 0, "affinity" : "0-3"}, ...}，缺省的项取def
+    const Json::Value &e = conf["executors"][name];
+    ExecutorConf ec = def;
+    ec.threads = e.get("threads", (Json::UInt)def.threads).asUInt();
+    ec.nice = e.get("nice", def.nice).asInt();
+    if (ec.nice < -20 || ec.nice > 19)
+    {
+        DF_ERROR("Config file - executor %s: nice must be in [-20, 19]: %d", name.c_str(), ec.nice);
+        return false;
+    }
+    std::string affinity = e.get("affinity", "").asString();
+    if (!parseCpuList(affinity, &ec.cpus))
+    {
+        DF_ERROR("Config file - executor %s: invalid affinity: %s", name.c_str(), affinity.c_str());
+        return false;
+    }
+    _executors[name] = ec;
+    return true;
+}
+
+bool Cloud::Config::parseCpuList(const std::string &list, std::vector<int> *cpus)
+{
+    auto number = [](const std::string &str, int *n)
+    {
+        if (str.empty() || str.size() > 4 || str.find_first_not_of("0123456789") != std::string::npos)
+            return false;
+        *n = std::stoi(str);
+        return true;
+    };
+
+    cpus->clear();
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        // 单个CPU "6" 或闭区间 "0-3"
+        size_t dash = item.find('-');
+        int lo, hi;
+        if (!number(item.substr(0, dash), &lo) || !number(dash == std::string::npos ? item : item.substr(dash + 1), &hi))
+            return false;
+        if (hi < lo || hi >= CPU_SETSIZE)
+            return false;
+        for (int c = lo; c <= hi; c++)
+            cpus->push_back(c);
+    }
     return true;
 }
 
@@ -134,4 +290,105 @@ unsigned Cloud::Config::getSvrPort() const
 std::string Cloud::Config::getManagerFile() const
 {
     return _manager_file;
-}
\ No newline at end of file
+}
+
+std::string Cloud::Config::getSnapshotFile() const
+{
+    return _snapshot_file;
+}
+
+std::string Cloud::Config::getJournalFile() const
+{
+    return _journal_file;
+}
+
+size_t Cloud::Config::getCompactThreshold() const
+{
+    return _compact_threshold;
+}
+
+std::string Cloud::Config::getDurability() const
+{
+    return _durability;
+}
+
+unsigned Cloud::Config::getFlushInterval() const
+{
+    return _flush_interval;
+}
+
+size_t Cloud::Config::getFlushBatch() const
+{
+    return _flush_batch;
+}
+
+std::string Cloud::Config::getMetaBackend() const
+{
+    return _meta_backend;
+}
+
+std::string Cloud::Config::getMetaDir() const
+{
+    return _meta_dir;
+}
+
+size_t Cloud::Config::getMaxSegments() const
+{
+    return _max_segments;
+}
+
+std::string Cloud::Config::getTrashDir() const
+{
+    return _trash_dir;
+}
+
+unsigned Cloud::Config::getAccessHalfLife() const
+{
+    return _access_half_life;
+}
+
+double Cloud::Config::getHotScore() const
+{
+    return _hot_score;
+}
+
+size_t Cloud::Config::getAccessCapacity() const
+{
+    return _access_capacity;
+}
+
+size_t Cloud::Config::getPackCacheSize() const
+{
+    return _pack_cache_size;
+}
+
+size_t Cloud::Config::getPackChunkSize() const
+{
+    return _pack_chunk_size;
+}
+
+double Cloud::Config::getCompressCpu() const
+{
+    return _compress_cpu;
+}
+
+std::string Cloud::Config::getCodecPolicy() const
+{
+    return _codec_policy;
+}
+
+size_t Cloud::Config::getStreamWindow() const
+{
+    return _stream_window;
+}
+
+Cloud::ExecutorConf Cloud::Config::getExecutor(const std::string &name) const
+{
+    auto it = _executors.find(name);
+    return it == _executors.end() ? ExecutorConf() : it->second;
+}
+
+unsigned Cloud::Config::getShutdownTimeout() const
+{
+    return _shutdown_timeout;
+}
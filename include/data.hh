@@ -1,56 +1,279 @@
 #pragma once
 #include <unordered_map>
+#include <set>
+#include <algorithm>
+#include <unordered_set>
+#include <string_view>
+#include <optional>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
 #include "util.hh"
 #include "config.hh"
+#include "timer.hh"
+#include "access.hh"
+#include "threadpool.hh"
 
 extern ckflogs::Logger::Ptr _logger;
 
 namespace Cloud
 {
+    // 路径拼接规则：real_path = backup_dir + 相对路径，pack_path = pack_dir + 相对路径 + arc_suffix，
+    // url = url_prefix + 相对路径，相对路径为"用户目录/文件名"。前缀只从配置读取一次
+    struct PathLayout
+    {
+        std::string url_prefix;
+        std::string backup_dir;
+        std::string pack_dir;
+        std::string arc_suffix;
+
+        static const PathLayout &get();
+
+        // 从url/real_path/pack_path中取出相对路径（指向参数内部），前缀不匹配时返回false
+        bool relOfURL(const std::string &url, std::string_view *rel) const;
+        bool relOfRealPath(const std::string &realPath, std::string_view *rel) const;
+        bool relOfPackPath(const std::string &packPath, std::string_view *rel) const;
+    };
+
     typedef struct BackupInfo // 备份文件数据
     {
-        bool pack_flag;        // 文件是否已压缩的标志
-        bool is_packing;       // 文件正在压缩中
+        using Ptr = std::shared_ptr<const BackupInfo>; // 只读视图：表中的记录不可变，修改时整体替换
+
+        // 紧凑布局：三条路径只存一份相对路径，按需拼接；8字节字段在前，标志位压缩在一个字节里
         size_t fsize;          // 文件大小
         time_t atime;          // 最近访问时间
         time_t mtime;          // 最近修改时间
-        std::string real_path; // 文件备份包存储路径
-        std::string pack_path; // 文件压缩包存储路径
-        std::string url;       // 文件url
+        std::string rel_path;  // 相对路径：用户目录/文件名
         int userID;            // 所属用户id
+        bool pack_flag : 1;    // 文件是否已压缩的标志
+        bool is_packing : 1;   // 文件正在压缩中
+        uint8_t codec;         // 压缩算法（bundle编号）；未压缩为bundle::RAW，CODEC_SKIP表示抽样判断为不可压缩
+
+        static const uint8_t CODEC_SKIP = 0xff; // 不可压缩的文件留在backup_dir，内容修改之前不再尝试压缩
 
         BackupInfo();
         BackupInfo(const std::string &backupPath, int userId);
+
+        std::string realPath() const; // 文件备份包存储路径
+        std::string packPath() const; // 文件压缩包存储路径
+        std::string url() const;      // 文件url
+        time_t coldTime() const;      // 冷却时刻：max(mtime, atime) + hot_time之后为非热点文件
+
+        Json::Value toJson() const;             // 序列化为Json对象（is_packing为运行时状态，不持久化）
+        void fromJson(const Json::Value &item); // 从Json对象恢复（兼容旧格式中的real_path/pack_path/url）
     } BackupInfo;
 
+    struct MetaChange;
+    class MetaStore;
+
     class BackupInfoManager // 文件数据管理器
     {
+    public:
+        enum SortKey // 分页查询的排序字段
+        {
+            SORT_BY_NAME,
+            SORT_BY_MTIME,
+            SORT_BY_SIZE
+        };
+
     private:
-        std::unordered_map<std::string, std::unique_ptr<BackupInfo>> _table; // url映射文件数据的表
-        Util::FileUtil _manager_file;                                        // 持久化备份文件数据
-        pthread_rwlock_t _rwlock;                                            // 读写锁
+        static const size_t shard_num = 16; // 分片个数
+        static const size_t recover_batch = 4096; // 后端带索引时，启动检查每批扫描的记录数
+
+        enum Durability // 元信息持久化模式
+        {
+            DURABILITY_SYNC,  // 请求线程中逐条追加日志并落盘
+            DURABILITY_GROUP, // 后台线程合并刷盘，请求线程等待本次修改落盘后返回
+            DURABILITY_ASYNC  // 后台线程合并刷盘，请求线程不等待
+        };
+
+        // 按相对路径哈希分片，每个分片独立加锁，不同文件的读写互不阻塞
+        // url、real_path、pack_path都由同一个相对路径拼接而来，去掉前缀即可定位分片和表项，
+        // 不再需要按路径的二级索引
+        // 表和用户索引的key都是指向记录自身rel_path的string_view，相对路径在内存中只存一份
+        // 后端带索引（lsm）时表中只有正在压缩的记录（is_packing不持久化），其余查询直接走后端，用户索引不使用
+        struct Shard
+        {
+            std::unordered_map<std::string_view, BackupInfo::Ptr> table;       // 相对路径映射文件数据的表
+            size_t dirty = 0;                                                   // 上次快照之后本分片的修改次数
+            std::unordered_set<std::string> pending;                            // 尚未刷盘的相对路径，多次修改只刷最后一次
+            pthread_rwlock_t rwlock;                                            // 读写锁
+        };
+
+        struct UserIndex // 单个用户的文件索引，各排序字段各自有序，分页时只需走到offset处
+        {
+            std::set<std::string_view> by_name;                     // 相对路径（同一用户目录下即文件名序）
+            std::set<std::pair<time_t, std::string_view>> by_mtime; // (mtime, 相对路径)
+            std::set<std::pair<size_t, std::string_view>> by_size;  // (fsize, 相对路径)
+        };
+
+        struct UserShard // 用户索引按userID分片，锁顺序：先Shard后UserShard
+        {
+            std::unordered_map<int, UserIndex> index; // userID -> 该用户的文件
+            pthread_rwlock_t rwlock;                  // 读写锁
+        };
+
+        Shard _shards[shard_num];           // 文件数据分片
+        UserShard _user_shards[shard_num];  // 用户索引分片
+        std::unique_ptr<MetaStore> _store;  // 元信息存储后端（meta_backend）
+        bool _resident;                     // 分片表是否常驻全部记录（后端不带索引时）
+        std::atomic<bool> _compacting;      // 同一时刻只允许一个线程压实
+        std::mutex _persist_mutex;          // 刷盘与压实互斥，保证写入后端的记录不会比整理结果旧
+
+        Durability _durability;             // 持久化模式
+        unsigned _flush_interval;           // 后台刷盘间隔（毫秒）
+        size_t _flush_batch;                // 待刷盘修改数达到该值时立即刷盘
+        std::atomic<uint64_t> _seq;         // 修改序号，每次修改加一
+        std::atomic<size_t> _pending;       // 上次刷盘之后的修改数
+        uint64_t _durable_seq;              // 已落盘的最大修改序号
+        size_t _waiters;                    // group模式下等待落盘的请求线程数
+        bool _stop_flusher;                 // 通知刷盘线程退出
+        std::mutex _durable_mutex;          // 保护_durable_seq、_waiters和_stop_flusher
+        std::condition_variable _durable_cond; // 等待修改落盘
+        std::condition_variable _flush_cond;   // 唤醒刷盘线程
+        std::thread _flusher;               // 后台刷盘线程（group/async模式）
+        std::string _trash_dir;             // 已删除文件的暂存目录（须与backup_dir/pack_dir在同一文件系统）
+        std::atomic<uint64_t> _trash_seq;   // 回收目录中的文件序号
+        DeadlineScheduler _cold_timer;      // 未压缩文件的冷却时刻，随每次修改更新
+        AccessTracker _access;              // 下载热度，删除、改名时一并清除
 
     public:
         BackupInfoManager();
         ~BackupInfoManager();
 
-        bool initLoad();                                            // 从备份管理文件中读取文件元信息（初始化）
-        bool storage();                                             // 保存文件元信息到备份管理文件（持久化）
+        bool initLoad();                                            // 从存储后端加载全部文件元信息（初始化）
+        bool storage();                                             // 把待刷盘的修改写入后端并整理（快照/写段）
 
         bool insert(const std::string &key, const BackupInfo &val); // 插入一个文件数据
         bool update(const std::string &key, const BackupInfo &val); // 修改一个文件数据
+        bool updateIfExists(const std::string &key, const BackupInfo &val); // 只修改仍存在的文件数据，已删除的不会被复活
+        // 压缩结束时写回（比较并替换）：只有记录仍在压缩中、且mtime和fsize与压缩开始时相同才写入，
+        // 否则说明压缩期间文件被重新上传，返回false，调用者丢弃压缩结果；
+        // 已压缩时在同一把锁内删除原文件，之后的重新上传不会被误删
+        bool finishPacking(const BackupInfo &val);
+        void cancelPacking(const std::string &url); // 上传覆盖文件之前调用：清除压缩标志，进行中的压缩写回时失败
+        // 删除一个文件数据并记录墓碑，磁盘文件在同一把锁内移入回收目录，trash返回待回收的文件路径
+        bool remove(const std::string &url, std::vector<std::string> *trash);
+        // 改名（同一用户目录下），磁盘文件一并改名；正在压缩或新名字已存在时失败
+        bool rename(const std::string &url, const std::string &newURL);
         bool getOneByURL(const std::string &url, BackupInfo *val);
         bool getOneByRealPath(const std::string &realPath, BackupInfo *val);
+        bool getOneByPackPath(const std::string &packPath, BackupInfo *val);
         bool getAll(std::vector<BackupInfo> *array);
+
+        // 只读视图版本：返回共享的不可变记录，不拷贝字符串；不存在时返回nullptr
+        BackupInfo::Ptr getOneByURL(const std::string &url);
+        BackupInfo::Ptr getOneByRealPath(const std::string &realPath);
+        BackupInfo::Ptr getOneByPackPath(const std::string &packPath);
+        bool getAll(std::vector<BackupInfo::Ptr> *array);
+        // 按用户分页查询：从游标after之后（为空则从头）跳过offset条，取至多limit条（limit为0表示取到末尾），
+        // total返回该用户的文件总数，next返回下一页的游标（没有下一页时为空）；游标格式不合法时返回false
+        bool getPageByUser(int userID, const std::string &after, size_t offset, size_t limit, SortKey key, bool desc,
+                           std::vector<BackupInfo::Ptr> *array, size_t *total, std::string *next);
+
+        DeadlineScheduler &coldTimer(); // 冷却时刻调度器，热点管理模块在最早时刻到达时处理
+        AccessTracker &accessTracker(); // 下载热度，由下载请求更新，决定冷却的文件是否压缩
+        void recordAccess(const BackupInfo::Ptr &bi, time_t now); // 记录一次下载：更新热度，仍然很热时推迟冷却时刻
+
+    private:
+        Shard &shardOf(std::string_view rel);                   // 相对路径 -> 分片
+        UserShard &userShardOf(int userID);
+        BackupInfo::Ptr findByRel(std::string_view rel);         // 按相对路径查找
+        BackupInfo::Ptr findLocked(Shard &shard, std::string_view rel); // 同findByRel（调用者持有分片锁）
+
+        template <typename Entry>
+        struct SortedIndex // 有序数组，提供collectPage用到的有序索引接口（后端带索引时按用户扫描后临时建立）
+        {
+            using key_type = Entry;
+            std::vector<Entry> items;
+            auto begin() const { return items.begin(); }
+            auto end() const { return items.end(); }
+            auto rbegin() const { return items.rbegin(); }
+            auto rend() const { return items.rend(); }
+            auto lower_bound(const Entry &e) const { return std::lower_bound(items.begin(), items.end(), e); }
+            auto upper_bound(const Entry &e) const { return std::upper_bound(items.begin(), items.end(), e); }
+        };
+        template <typename Index>
+        static bool collectPage(const Index &index, const std::string &after, size_t offset, size_t limit, bool desc,
+                                std::vector<std::string> *rels, std::string *next); // 从有序索引中取出一页相对路径（调用者持有读锁）
+        bool getPageFromStore(int userID, const std::string &after, size_t offset, size_t limit, SortKey key, bool desc,
+                              std::vector<BackupInfo::Ptr> *array, size_t *total, std::string *next); // 后端按用户目录前缀扫描后分页
+        void overlayPacking(std::vector<BackupInfo::Ptr> *records); // 后端扫描结果（按相对路径有序）换成分片表中正在压缩的记录
+        void putLocked(Shard &shard, const BackupInfo::Ptr &bi);    // 同时更新表和用户索引（调用者持有分片写锁）
+        void eraseLocked(Shard &shard, std::string_view rel);       // 同时删除表项和用户索引（调用者持有分片写锁）
+        void scheduleCold(const BackupInfo::Ptr &bi);               // 未压缩的文件按冷却时刻调度，其余取消
+        bool compact();                                // 刷盘 + 后端整理（调用者持有_persist_mutex，不持有任何分片锁）
+        MetaChange recordOf(Shard &shard, const std::string &rel); // 生成相对路径当前状态的修改记录（调用者持有分片锁）
+        // 记录一批修改，info为nullptr表示删除（调用者持有涉及的分片写锁，且在修改内存表之前调用：失败时内存表不变）
+        // 同一批修改一次写入后端，要么都写入要么都没有写入
+        bool logChange(const std::vector<MetaChange> &changes, uint64_t *seq);
+        bool commitChange(uint64_t seq);               // 按持久化模式完成一次修改（调用者不持有任何分片锁）
+        void maybeCompact();                           // 后端需要整理时交给io执行器压实（调用者不持有任何分片锁）
+        void flushLoop();                              // 刷盘线程：每隔flush_interval、攒够flush_batch次修改或有线程等待落盘时刷一次
+        bool flushOnce();                              // 把各分片待刷盘的修改合并写入后端
+        bool flushLocked();                            // 同flushOnce（调用者持有_persist_mutex）
+        bool markDurable(uint64_t target);             // 序号不超过target的修改已落盘，唤醒等待的请求线程
+        std::string trashPathOf(const BackupInfo &bi, const std::string &path); // 回收目录中的文件名：序号#用户目录#文件名
+        bool recoverTrash();                           // 启动时处理上次没有回收的文件
+        bool recoverFiles();                           // 启动时让backup_dir、pack_dir与元信息一致（压缩中途崩溃后的清理）
+        size_t recoverRecords(Shard &shard, const std::vector<BackupInfo::Ptr> &records); // 逐条检查一个分片的记录对应的磁盘文件，返回修正的记录数
+        size_t recoverUserDir(const std::string &userDir); // 收养一个用户目录中没有记录的文件、清理多余的压缩包，返回修正数
     };
 }
 
+#include "store.hh" // 依赖BackupInfo的完整定义
+#include "pack.hh"  // 依赖Snapshot::checksum
+
+// PathLayout
+const Cloud::PathLayout &Cloud::PathLayout::get()
+{
+    static PathLayout layout = []()
+    {
+        Cloud::Config *conf = Cloud::Config::getInstance();
+        PathLayout l;
+        l.url_prefix = conf->getUrlPrefix();
+        l.backup_dir = conf->getBackupDir();
+        l.pack_dir = conf->getPackDir();
+        l.arc_suffix = conf->getArcSuffix();
+        return l;
+    }();
+    return layout;
+}
+
+bool Cloud::PathLayout::relOfURL(const std::string &url, std::string_view *rel) const
+{
+    if (url.compare(0, url_prefix.size(), url_prefix) != 0)
+        return false;
+    *rel = std::string_view(url).substr(url_prefix.size());
+    return true;
+}
+
+bool Cloud::PathLayout::relOfRealPath(const std::string &realPath, std::string_view *rel) const
+{
+    if (realPath.compare(0, backup_dir.size(), backup_dir) != 0)
+        return false;
+    *rel = std::string_view(realPath).substr(backup_dir.size());
+    return true;
+}
+
+bool Cloud::PathLayout::relOfPackPath(const std::string &packPath, std::string_view *rel) const
+{
+    if (packPath.size() < pack_dir.size() + arc_suffix.size() ||
+        packPath.compare(0, pack_dir.size(), pack_dir) != 0 ||
+        packPath.compare(packPath.size() - arc_suffix.size(), arc_suffix.size(), arc_suffix) != 0)
+        return false;
+    *rel = std::string_view(packPath).substr(pack_dir.size(), packPath.size() - pack_dir.size() - arc_suffix.size());
+    return true;
+}
+
 // BackupInfo
-Cloud::BackupInfo::BackupInfo() : is_packing(false)
+Cloud::BackupInfo::BackupInfo()
+    : fsize(0), atime(0), mtime(0), userID(0), pack_flag(false), is_packing(false), codec(bundle::RAW)
 {
 }
 
 Cloud::BackupInfo::BackupInfo(const std::string &backupPath, int userId)
+    : BackupInfo()
 {
     // 根据文件实际存储路径，填充文件元信息
     Util::FileUtil fu(backupPath);
@@ -60,205 +283,1343 @@ Cloud::BackupInfo::BackupInfo(const std::string &backupPath, int userId)
         return;
     }
 
-    pack_flag = false;
-    is_packing = false;
     fsize = fu.fileSize();
     atime = fu.lastAccessTime();
     mtime = fu.lastModTime();
-    real_path = backupPath;
     userID = userId;
 
-    //拼接pack_path和url
-    Cloud::Config *conf = Cloud::Config::getInstance();
-    std::string suffix = backupPath.substr(conf->getBackupDir().size());
-    pack_path = conf->getPackDir() + suffix + conf->getArcSuffix();
-    url = conf->getUrlPrefix() + suffix;
+    // 只保存相对路径，pack_path和url按需拼接
+    std::string_view rel;
+    if (!PathLayout::get().relOfRealPath(backupPath, &rel))
+    {
+        DF_ERROR("%s 不在备份目录中", backupPath.c_str());
+        return;
+    }
+    rel_path = std::string(rel);
 
-    _logger->_debug("real_path: %s, pack_path: %s, url: %s", real_path.c_str(), pack_path.c_str(), url.c_str());
+    _logger->_debug("real_path: %s, pack_path: %s, url: %s", realPath().c_str(), packPath().c_str(), url().c_str());
 }
 
+std::string Cloud::BackupInfo::realPath() const
+{
+    return PathLayout::get().backup_dir + rel_path;
+}
+
+std::string Cloud::BackupInfo::packPath() const
+{
+    const PathLayout &l = PathLayout::get();
+    return l.pack_dir + rel_path + l.arc_suffix;
+}
+
+std::string Cloud::BackupInfo::url() const
+{
+    return PathLayout::get().url_prefix + rel_path;
+}
+
+time_t Cloud::BackupInfo::coldTime() const
+{
+    // 与当前时间的差值大于hot_time才是非热点文件
+    return std::max(mtime, atime) + Cloud::Config::getInstance()->getHotTime() + 1;
+}
+
+Json::Value Cloud::BackupInfo::toJson() const
+{
+    Json::Value item;
+    item["pack_flag"] = pack_flag;
+    item["fsize"] = static_cast<Json::UInt64>(fsize);
+    item["atime"] = static_cast<Json::Int64>(atime);
+    item["mtime"] = static_cast<Json::Int64>(mtime);
+    item["path"] = rel_path;
+    item["userID"] = userID;
+    item["codec"] = codec;
+    return item;
+}
+
+void Cloud::BackupInfo::fromJson(const Json::Value &item)
+{
+    atime = item["atime"].asInt64();
+    mtime = item["mtime"].asInt64();
+    fsize = item["fsize"].asUInt64();
+    pack_flag = item["pack_flag"].asBool();
+    is_packing = false;
+    userID = item["userID"].asInt();
+    codec = item.get("codec", bundle::RAW).asUInt();
+
+    if (item.isMember("path"))
+    {
+        rel_path = item["path"].asString();
+    }
+    else // 旧格式：从url中取出相对路径
+    {
+        std::string url = item["url"].asString();
+        std::string_view rel;
+        rel_path = PathLayout::get().relOfURL(url, &rel) ? std::string(rel) : url;
+    }
+}
 
 // BackupInfoManager
 Cloud::BackupInfoManager::BackupInfoManager()
-    : _manager_file(Cloud::Config::getInstance()->getManagerFile())
+    : _store(MetaStore::create()),
+      _resident(!_store->indexed()),
+      _compacting(false),
+      _flush_interval(Cloud::Config::getInstance()->getFlushInterval()),
+      _flush_batch(Cloud::Config::getInstance()->getFlushBatch()),
+      _seq(0), _pending(0), _durable_seq(0), _waiters(0), _stop_flusher(false),
+      _trash_dir(Cloud::Config::getInstance()->getTrashDir()), _trash_seq(0),
+      _access(Cloud::Config::getInstance()->getAccessHalfLife(), Cloud::Config::getInstance()->getAccessCapacity())
 {
-    pthread_rwlock_init(&_rwlock, nullptr);
+    Cloud::Config *conf = Cloud::Config::getInstance();
+    std::string durability = conf->getDurability();
+    if (durability == "sync")
+        _durability = DURABILITY_SYNC;
+    else if (durability == "async")
+        _durability = DURABILITY_ASYNC;
+    else
+        _durability = DURABILITY_GROUP;
+
+    for (size_t i = 0; i < shard_num; i++)
+    {
+        pthread_rwlock_init(&_shards[i].rwlock, nullptr);
+        pthread_rwlock_init(&_user_shards[i].rwlock, nullptr);
+    }
     
     if(!initLoad())//初始化备份文件元信息
     {
         _logger->_error("备份信息初始化失败");
         exit(-1);
     }
-    _logger->_debug("数据管理模块-备份信息初始化成功, 当前文件个数 %d", _table.size());
+
+    if (_resident)
+    {
+        size_t count = 0;
+        for (size_t i = 0; i < shard_num; i++)
+            count += _shards[i].table.size();
+        _logger->_debug("数据管理模块-备份信息初始化成功, 当前文件个数 %d", count);
+    }
+    else
+        _logger->_debug("数据管理模块-备份信息初始化成功, 查询直接走存储后端");
+
+    if (_durability != DURABILITY_SYNC)
+        _flusher = std::thread(&Cloud::BackupInfoManager::flushLoop, this);
 }
 
 Cloud::BackupInfoManager::~BackupInfoManager()
 {
-    pthread_rwlock_destroy(&_rwlock);
+    if (_flusher.joinable())
+    {
+        {
+            std::unique_lock<std::mutex> lck(_durable_mutex);
+            _stop_flusher = true;
+        }
+        _flush_cond.notify_one();
+        _flusher.join();
+        flushOnce(); // 把剩余的修改刷盘
+    }
+
+    for (size_t i = 0; i < shard_num; i++)
+    {
+        pthread_rwlock_destroy(&_shards[i].rwlock);
+        pthread_rwlock_destroy(&_user_shards[i].rwlock);
+    }
+}
+
+Cloud::BackupInfoManager::Shard &Cloud::BackupInfoManager::shardOf(std::string_view rel)
+{
+    return _shards[std::hash<std::string_view>()(rel) % shard_num];
+}
+
+Cloud::BackupInfoManager::UserShard &Cloud::BackupInfoManager::userShardOf(int userID)
+{
+    return _user_shards[static_cast<size_t>(userID) % shard_num];
 }
 
-// 原来Json可以当作数组用！遂修改如下
 bool Cloud::BackupInfoManager::initLoad()
 {
-    if (!_manager_file.isExists())//没有备份信息
-        return true;
+    // 构造期间单线程执行，写入时仍按分片加锁以复用putLocked/eraseLocked
+    // 后端带索引时不交回数据，冷却时刻在启动检查逐条扫描时调度
+    MetaStore::Loader loader;
+    if (_resident)
+    {
+        loader = [this](const std::string &rel, const BackupInfo *bi)
+        {
+            Shard &shard = shardOf(rel);
+            if (bi)
+                putLocked(shard, std::make_shared<const BackupInfo>(*bi));
+            else
+                eraseLocked(shard, rel);
+        };
+    }
+    bool ok = _store->open(loader);
+    return ok && recoverTrash() && recoverFiles();
+}
 
-    // 1.从备份文件中读出文件数据
-    std::string backup;
-    if (!_manager_file.getContent(backup))
+bool Cloud::BackupInfoManager::recoverTrash()
+{
+    Util::FileUtil dir(_trash_dir);
+    if (!dir.createDirectory())
     {
-        DF_ERROR("Get backup file failed");
+        DF_ERROR("%s: Create trash dir failed", _trash_dir.c_str());
         return false;
     }
 
-    if(backup.empty())//备份信息为空
+    std::vector<std::string> files;
+    dir.scanDirectory(files);
+    const PathLayout &l = PathLayout::get();
+    size_t restored = 0;
+    for (const std::string &path : files)
+    {
+        // 文件名：序号#用户目录#文件名（压缩包带后缀）
+        std::string name = Util::FileUtil(path).fileName();
+        size_t p1 = name.find('#');
+        size_t p2 = p1 == std::string::npos ? p1 : name.find('#', p1 + 1);
+        if (p2 != std::string::npos)
+        {
+            std::string rel = name.substr(p1 + 1, p2 - p1 - 1) + "/" + name.substr(p2 + 1);
+
+            // 元信息中文件仍存在：墓碑没有落盘就崩溃了，把文件放回原处
+            std::string origin;
+            BackupInfo::Ptr bi = findByRel(rel);
+            if (bi && !bi->pack_flag)
+                origin = bi->realPath();
+            else if (rel.size() > l.arc_suffix.size() &&
+                     (bi = findByRel(rel.substr(0, rel.size() - l.arc_suffix.size()))) && bi->pack_flag)
+                origin = bi->packPath();
+
+            if (!origin.empty() && !Util::FileUtil(origin).isExists() && ::rename(path.c_str(), origin.c_str()) == 0)
+            {
+                restored++;
+                continue;
+            }
+        }
+        Util::FileUtil(path).remove();
+    }
+
+    if (!files.empty())
+        _logger->_info("回收目录处理完成, 恢复 %d 个, 删除 %d 个", restored, files.size() - restored);
+    return true;
+}
+
+bool Cloud::BackupInfoManager::recoverFiles()
+{
+    // 压缩按"写临时文件 -> fsync -> rename -> 修改元信息 -> 删除原文件"的顺序进行，任何时刻崩溃磁盘上都至少有一份完整数据；
+    // 启动时（刷盘线程启动之前）逐条比对，按元信息保留一份、删除多余的一份，元信息丢失的文件重新收养
+    // 分片之间、用户目录之间互不相干，分给io执行器的线程并行检查
+    const PathLayout &l = PathLayout::get();
+    ckf::ThreadPool &io = ckf::ThreadPool::getInstance(ckf::ThreadPool::IO);
+    std::atomic<size_t> fixed(0);
+    auto parallel = [&io](size_t n, const std::function<void(size_t)> &func)
+    {
+        std::atomic<size_t> next(0);
+        std::vector<std::future<void>> done;
+        for (size_t t = 0; t < std::min(io.size(), n); t++)
+        {
+            done.push_back(io.submit(ckf::ThreadPool::LV1, [&]()
+            {
+                for (size_t i = next++; i < n; i = next++)
+                    func(i);
+            }));
+        }
+        for (std::future<void> &f : done)
+            f.wait();
+    };
+
+    // 1.已有的记录：以元信息为准核对backup_dir和pack_dir
+    //   后端带索引时分批扫描，每批按分片分组后并行检查，不需要一次取出全部记录
+    if (_resident)
+    {
+        parallel(shard_num, [&](size_t i)
+        {
+            std::vector<BackupInfo::Ptr> records;
+            {
+                Util::RDLockGuard lock(&_shards[i].rwlock);
+                records.reserve(_shards[i].table.size());
+                for (auto &[rel, bi] : _shards[i].table)
+                    records.push_back(bi);
+            }
+            fixed += recoverRecords(_shards[i], records);
+        });
+    }
+    else
+    {
+        std::string after;
+        std::vector<BackupInfo::Ptr> batch;
+        do
+        {
+            batch.clear();
+            _store->scan("", after, recover_batch, &batch);
+            if (batch.empty())
+                break;
+            after = batch.back()->rel_path;
+
+            std::vector<BackupInfo::Ptr> groups[shard_num];
+            for (BackupInfo::Ptr &bi : batch)
+                groups[&shardOf(bi->rel_path) - _shards].push_back(bi);
+            parallel(shard_num, [&](size_t i)
+            {
+                fixed += recoverRecords(_shards[i], groups[i]);
+            });
+        } while (batch.size() == recover_batch);
+    }
+
+    // 2.没有记录的文件：backup_dir中的重新收养，pack_dir中的按需收养或删除，未写完的压缩包直接删除
+    std::set<std::string> userDirs;
+    for (const std::string &root : {l.backup_dir, l.pack_dir})
+    {
+        if (!Util::FileUtil(root).isExists())
+            continue;
+        std::vector<std::string> entries;
+        Util::FileUtil(root).scanDirectory(entries);
+        for (const std::string &path : entries)
+        {
+            if (Util::fs::is_directory(path))
+                userDirs.insert(Util::FileUtil(path).fileName());
+        }
+    }
+    std::vector<std::string> dirs(userDirs.begin(), userDirs.end());
+    parallel(dirs.size(), [&](size_t i)
+    {
+        fixed += recoverUserDir(dirs[i]);
+    });
+
+    if (fixed == 0)
         return true;
 
-    // 2.反序列为Json
-    Json::Value root;
-    if (!Util::JsonUtil::unserialize(backup, &root))
+    // 修正结果立即写入后端并整理，之后的崩溃不需要再次修正
+    _logger->_info("文件一致性检查完成, 修正 %d 处", fixed.load());
+    return storage();
+}
+
+size_t Cloud::BackupInfoManager::recoverRecords(Shard &shard, const std::vector<BackupInfo::Ptr> &records)
+{
+    Util::WRLockGuard lock(&shard.rwlock);
+
+    size_t fixed = 0;
+    uint64_t seq = 0;
+    for (const BackupInfo::Ptr &old : records)
     {
-        DF_ERROR("Json unserialize failed");
-        return false;
+        if (!_resident) // 没有经过putLocked加载，在这里调度；需要修正的记录随后重新调度
+            scheduleCold(old);
+
+        std::string realPath = old->realPath();
+        std::string packPath = old->packPath();
+        Util::FileUtil real(realPath);
+        bool hasReal = real.isExists();
+
+        // 压缩包只有完整且与记录的大小一致时才算有效
+        PackReader reader(packPath);
+        bool hasPack = Util::FileUtil(packPath).isExists();
+        bool validPack = hasPack && reader.open() && reader.size() == old->fsize;
+
+        BackupInfo bi = *old;
+        bool drop = false;
+        if (!old->pack_flag)
+        {
+            if (hasReal && hasPack) // 压缩包已写好、元信息未修改时崩溃：保留原文件，稍后重新压缩
+                Util::FileUtil(packPath).remove();
+            else if (!hasReal && validPack) // 元信息修改没有落盘、原文件已删除
+            {
+                bi.pack_flag = true;
+                bi.codec = reader.codec();
+            }
+            else if (!hasReal)
+                drop = true;
+            else
+                continue;
+        }
+        else
+        {
+            if (validPack && hasReal)
+            {
+                // 只有大小和精确到纳秒的修改时间都与压缩时一致，才是压缩前的原文件，否则是压缩之后重新上传的
+                struct stat st;
+                bool packed = ::stat(realPath.c_str(), &st) == 0 && (uint64_t)st.st_size == old->fsize &&
+                              st.st_mtim.tv_sec == old->mtime && (uint32_t)st.st_mtim.tv_nsec == reader.srcMtimeNs();
+                if (!packed) // 压缩之后又被重新上传：以新内容为准
+                {
+                    bi = BackupInfo(realPath, old->userID);
+                    Util::FileUtil(packPath).remove();
+                }
+                else // 元信息已修改、原文件未删除时崩溃
+                {
+                    real.remove();
+                    continue;
+                }
+            }
+            else if (!validPack && hasReal) // 压缩包损坏或丢失，原文件还在
+            {
+                if (hasPack)
+                    Util::FileUtil(packPath).remove();
+                bi = BackupInfo(realPath, old->userID);
+            }
+            else if (!validPack)
+                drop = true;
+            else
+                continue;
+        }
+
+        fixed++;
+        // 内存表以磁盘上的文件为准，记录写入失败也照常修正，留到下次启动时再检查
+        BackupInfo::Ptr info = drop ? nullptr : std::make_shared<const BackupInfo>(bi);
+        logChange({MetaChange{old->rel_path, info}}, &seq);
+        if (drop)
+        {
+            _logger->_warn("文件 %s 的数据已丢失, 删除备份信息", realPath.c_str());
+            if (hasPack)
+                Util::FileUtil(packPath).remove();
+            eraseLocked(shard, old->rel_path);
+        }
+        else
+            putLocked(shard, info);
+    }
+    return fixed;
+}
+
+size_t Cloud::BackupInfoManager::recoverUserDir(const std::string &userDir)
+{
+    const PathLayout &l = PathLayout::get();
+    // 用户目录名是5位补零的用户id（UserManager::getDirName）
+    if (userDir.empty() || userDir.find_first_not_of("0123456789") != std::string::npos)
+        return 0;
+    int userID = std::stoi(userDir);
+
+    size_t fixed = 0;
+    uint64_t seq = 0;
+    auto adopt = [&](const BackupInfo &bi)
+    {
+        Shard &shard = shardOf(bi.rel_path);
+        Util::WRLockGuard lock(&shard.rwlock);
+        if (findLocked(shard, bi.rel_path))
+            return false;
+        BackupInfo::Ptr info = std::make_shared<const BackupInfo>(bi);
+        logChange({MetaChange{bi.rel_path, info}}, &seq);
+        putLocked(shard, info);
+        return true;
+    };
+
+    // 1.backup_dir中没有记录的文件：上传后、写入元信息之前崩溃，或元信息没有落盘
+    std::vector<std::string> files;
+    std::string dir = l.backup_dir + userDir + "/";
+    if (Util::FileUtil(dir).isExists())
+        Util::FileUtil(dir).scanDirectory(files);
+    for (const std::string &path : files)
+    {
+        std::string_view rel;
+        if (!l.relOfRealPath(path, &rel) || findByRel(rel) || Util::fs::is_directory(path))
+            continue;
+        BackupInfo bi(path, userID);
+        if (!bi.rel_path.empty() && adopt(bi))
+        {
+            _logger->_warn("文件 %s 没有备份信息, 重新收养", path.c_str());
+            fixed++;
+        }
     }
 
-    // 3.初始化
-    for (int i = 0; i < root.size(); i++)
+    // 2.pack_dir中没有记录或记录未压缩的压缩包
+    files.clear();
+    dir = l.pack_dir + userDir + "/";
+    if (Util::FileUtil(dir).isExists())
+        Util::FileUtil(dir).scanDirectory(files);
+    for (const std::string &path : files)
     {
-        Json::Value item = root[i];
+        std::string suffix = PackWriter::tmp_suffix;
+        if (path.size() > suffix.size() && path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0)
+        {
+            // 压缩中途崩溃留下的临时文件
+            Util::FileUtil(path).remove();
+            fixed++;
+            continue;
+        }
+
+        std::string_view rel;
+        if (!l.relOfPackPath(path, &rel))
+            continue;
+        BackupInfo::Ptr old = findByRel(rel);
+        if (old && old->pack_flag)
+            continue;
 
+        // 原文件已删除而元信息丢失：从压缩包重建记录，否则压缩包是多余的
+        PackReader reader(path);
         BackupInfo bi;
-        bi.atime = item["atime"].asUInt();
-        bi.mtime = item["mtime"].asUInt();
-        bi.fsize = item["fsize"].asUInt();
-        bi.pack_flag = item["pack_flag"].asBool();
-        bi.pack_path = item["pack_path"].asString();
-        bi.real_path = item["real_path"].asString();
-        bi.url = item["url"].asString();
-        bi.userID = item["userID"].asInt();
-        
-        insert(bi.url, bi);
+        bi.rel_path = std::string(rel);
+        bi.userID = userID;
+        bi.pack_flag = true;
+        if (!old && reader.open())
+        {
+            bi.fsize = reader.size();
+            bi.codec = reader.codec();
+            bi.atime = bi.mtime = reader.mtime();
+        }
+        if (!old && bi.mtime != 0 && !Util::FileUtil(bi.realPath()).isExists() && adopt(bi))
+            _logger->_warn("压缩包 %s 没有备份信息, 重新收养", path.c_str());
+        else
+            Util::FileUtil(path).remove();
+        fixed++;
     }
+    return fixed;
+}
 
-    return true;
+std::string Cloud::BackupInfoManager::trashPathOf(const BackupInfo &bi, const std::string &path)
+{
+    std::string userDir = bi.rel_path.substr(0, bi.rel_path.find('/'));
+    return _trash_dir + std::to_string(time(nullptr)) + "." + std::to_string(++_trash_seq) + "#" +
+           userDir + "#" + Util::FileUtil(path).fileName();
 }
 
 bool Cloud::BackupInfoManager::storage()
 {
-    if (_table.empty())
+    // 与刷盘互斥；不锁分片，压实期间请求线程照常读写
+    std::unique_lock<std::mutex> persist(_persist_mutex);
+    return compact();
+}
+
+bool Cloud::BackupInfoManager::compact()
+{
+    // 没有任何分片被修改过，后端已是最新；记下各分片此刻的修改数，压实期间新增的留到下次
+    size_t dirtyAt[shard_num];
+    size_t dirty = 0;
+    for (size_t i = 0; i < shard_num; i++)
+    {
+        Util::RDLockGuard lock(&_shards[i].rwlock);
+        dirtyAt[i] = _shards[i].dirty;
+        dirty += dirtyAt[i];
+    }
+    if (dirty == 0)
+        return true;
+
+    // 1.先把待刷盘的修改写入后端（sync模式下请求线程直接写入，没有待刷盘的修改）
+    if (!flushLocked())
+        return false;
+
+    // 2.后端整理：journal写快照并丢弃此前的日志，lsm把内存表写成段
+    //   逐个分片在读锁内取出记录的共享视图，遍历和写文件都在锁外进行；
+    //   后端在取视图之前记下日志位置，压实期间写入的记录留在日志中
+    bool ok = _store->checkpoint([this](const MetaStore::Visitor &visit)
     {
-        DF_WARN("No BackupInfo need to storage");
+        std::vector<BackupInfo::Ptr> views;
+        for (size_t i = 0; i < shard_num; i++)
+        {
+            Util::RDLockGuard lock(&_shards[i].rwlock);
+            views.reserve(views.size() + _shards[i].table.size());
+            for (auto &[k, v] : _shards[i].table)
+                views.push_back(v);
+        }
+        for (const BackupInfo::Ptr &v : views)
+            visit(*v);
+    });
+    if (!ok)
         return false;
+
+    for (size_t i = 0; i < shard_num; i++)
+    {
+        Util::WRLockGuard lock(&_shards[i].rwlock);
+        _shards[i].dirty -= dirtyAt[i];
     }
-    // 1.获取所有文件元信息
-    std::vector<BackupInfo> array;
-    getAll(&array);
 
-    // 2.将文件元信息转化为json对象（root视为Json数组）
-    Json::Value root;
+    _logger->_debug("备份信息压实完成, 合并修改 %d 次", dirty);
+    return true;
+}
 
-    Util::RDLockGuard(&this->_rwlock);
-    for (auto v : array)
+void Cloud::BackupInfoManager::putLocked(Shard &shard, const BackupInfo::Ptr &bi)
+{
+    // 新记录自身的rel_path作为表和用户索引的key
+    std::string_view key = bi->rel_path;
+    if (!_resident)
     {
-        Json::Value item;
-        item["pack_flag"] = v.pack_flag;
-        item["fsize"] = static_cast<Json::UInt64>(v.fsize);
-        item["atime"] = static_cast<Json::Int64>(v.atime);
-        item["mtime"] = static_cast<Json::Int64>(v.mtime);
-        item["real_path"] = v.real_path;
-        item["pack_path"] = v.pack_path;
-        item["url"] = v.url;
-        item["userID"] = v.userID;
+        // 后端已有这条记录：表中只保留正在压缩的（is_packing不持久化），不维护用户索引
+        shard.table.erase(key);
+        if (bi->is_packing)
+            shard.table.emplace(key, bi);
+        scheduleCold(bi);
+        return;
+    }
 
-        root.append(item);
+    auto it = shard.table.find(key);
+    if (it != shard.table.end())
+    {
+        // 先摘掉指向旧记录的索引项，再整体替换，持有旧视图的读者不受影响
+        const BackupInfo &old = *it->second;
+        std::string_view oldKey = old.rel_path;
+        UserShard &oldUs = userShardOf(old.userID);
+        {
+            Util::WRLockGuard lock(&oldUs.rwlock);
+            UserIndex &ui = oldUs.index[old.userID];
+            ui.by_name.erase(oldKey);
+            ui.by_mtime.erase({old.mtime, oldKey});
+            ui.by_size.erase({old.fsize, oldKey});
+        }
+        shard.table.erase(it);
     }
+    shard.table.emplace(key, bi);
+    scheduleCold(bi);
+
+    UserShard &us = userShardOf(bi->userID);
+    Util::WRLockGuard lock(&us.rwlock);
+    UserIndex &ui = us.index[bi->userID];
+    ui.by_name.insert(key);
+    ui.by_mtime.insert({bi->mtime, key});
+    ui.by_size.insert({bi->fsize, key});
+}
 
-    // 3.序列化json
-    std::string str;
-    if (!Util::JsonUtil::serialize(root, &str))
+void Cloud::BackupInfoManager::eraseLocked(Shard &shard, std::string_view rel)
+{
+    auto it = shard.table.find(rel);
+    if (!_resident)
     {
-        DF_ERROR("Json serialize failed");
-        return false;
+        // 后端带索引时记录多半不在表中，定时器和访问热度照样清理
+        _cold_timer.cancel(rel);
+        _access.forget(rel);
+        if (it != shard.table.end())
+            shard.table.erase(it);
+        return;
     }
+    if (it == shard.table.end())
+        return;
 
-    // 4.持久化存储
-    if (!_manager_file.setContent(str))
+    const BackupInfo &old = *it->second;
+    std::string_view oldKey = old.rel_path;
+    _cold_timer.cancel(oldKey);
+    _access.forget(oldKey);
+    UserShard &us = userShardOf(old.userID);
     {
-        DF_ERROR("Set backup file failed");
-        return false;
+        Util::WRLockGuard lock(&us.rwlock);
+        UserIndex &ui = us.index[old.userID];
+        ui.by_name.erase(oldKey);
+        ui.by_mtime.erase({old.mtime, oldKey});
+        ui.by_size.erase({old.fsize, oldKey});
+    }
+    shard.table.erase(it);
+}
+
+void Cloud::BackupInfoManager::scheduleCold(const BackupInfo::Ptr &bi)
+{
+    // 未压缩的文件按新的冷却时刻调度，已压缩、正在压缩或不可压缩的不再调度
+    if (!bi->pack_flag && !bi->is_packing && bi->codec != BackupInfo::CODEC_SKIP)
+        _cold_timer.schedule(DeadlineScheduler::keyOf(bi), bi->coldTime());
+    else
+        _cold_timer.cancel(bi->rel_path);
+}
+
+Cloud::MetaChange Cloud::BackupInfoManager::recordOf(Shard &shard, const std::string &rel)
+{
+    auto it = shard.table.find(rel);
+    if (it != shard.table.end())
+        return MetaChange{rel, it->second};
+    return MetaChange{rel, nullptr};
+}
+
+bool Cloud::BackupInfoManager::logChange(const std::vector<MetaChange> &changes, uint64_t *seq)
+{
+    if (_durability == DURABILITY_SYNC || !_resident)
+    {
+        // 同步模式：在分片锁内、修改内存表之前写入后端，保证同一文件的记录按修改顺序落盘，
+        // 写入失败时内存表保持原样，不会出现内存中有而后端中没有的修改
+        // 后端带索引时查询直接走后端，group/async模式也要先写入（不fdatasync），由刷盘线程统一sync
+        bool durable = _durability == DURABILITY_SYNC;
+        if (!_store->write(changes, durable))
+            return false;
+        for (const MetaChange &c : changes)
+            shardOf(c.rel).dirty++;
+        *seq = durable ? 0 : ++_seq;
+        return true;
     }
 
+    // group/async模式：只标记，由刷盘线程按表中的当前状态合并写入（刷盘持有分片锁，看不到修改的中间状态），
+    // 写入失败时刷盘线程重新标记并重试
+    for (const MetaChange &c : changes)
+    {
+        Shard &shard = shardOf(c.rel);
+        shard.dirty++;
+        shard.pending.insert(c.rel);
+    }
+    *seq = ++_seq;
     return true;
 }
 
-bool Cloud::BackupInfoManager::insert(const std::string &key, const BackupInfo &val)
+bool Cloud::BackupInfoManager::commitChange(uint64_t seq)
 {
-    Util::WRLockGuard(&this->_rwlock); // 读写锁，不能并行读写
+    if (_durability == DURABILITY_SYNC)
+    {
+        maybeCompact();
+        return true;
+    }
+
+    if (++_pending >= _flush_batch)
+        _flush_cond.notify_one();
 
-    if (_table.count(key) != 0) // 已存在
+    if (_durability == DURABILITY_GROUP)
     {
-        DF_WARN("BackupInfo exists")
+        // 等待刷盘线程把本次修改落盘；有线程在等待时刷盘线程立即开始，
+        // 上一次fdatasync期间到来的修改自然合并到下一批
+        std::unique_lock<std::mutex> lck(_durable_mutex);
+        if (_durable_seq >= seq)
+            return true;
+        _waiters++;
+        _flush_cond.notify_one();
+        _durable_cond.wait(lck, [&]()
+                           { return _durable_seq >= seq; });
+        _waiters--;
+    }
+    return true;
+}
+
+void Cloud::BackupInfoManager::flushLoop()
+{
+    std::unique_lock<std::mutex> lck(_durable_mutex);
+    while (!_stop_flusher)
+    {
+        _flush_cond.wait_for(lck, std::chrono::milliseconds(_flush_interval), [this]()
+                             { return _stop_flusher || (_waiters > 0 && _durable_seq < _seq) || _pending >= _flush_batch; });
+        if (_stop_flusher)
+            break;
+        if (_durable_seq >= _seq) // 没有尚未落盘的修改
+            continue;
+
+        lck.unlock();
+        if (flushOnce())
+            maybeCompact();
+        lck.lock();
+    }
+}
+
+bool Cloud::BackupInfoManager::flushOnce()
+{
+    std::unique_lock<std::mutex> persist(_persist_mutex);
+    return flushLocked();
+}
+
+bool Cloud::BackupInfoManager::flushLocked()
+{
+    // 1.取出各分片待刷盘的相对路径，按当前状态生成记录（多次修改只保留最后一次）
+    // 先清零计数再读序号：计数清零之前完成的修改，其序号一定不大于target
+    _pending = 0;
+    uint64_t target = _seq.load();
+    if (!_resident)
+    {
+        // 后端带索引：修改已在请求线程写入后端，这里只需一次fdatasync
+        if (!_store->sync())
+            return false;
+        return markDurable(target);
+    }
+
+    std::vector<MetaChange> changes;
+    for (size_t i = 0; i < shard_num; i++)
+    {
+        Shard &shard = _shards[i];
+        Util::WRLockGuard lock(&shard.rwlock);
+        for (const std::string &rel : shard.pending)
+            changes.push_back(recordOf(shard, rel));
+        shard.pending.clear();
+    }
+
+    // 2.一次write + 一次fdatasync
+    if (!changes.empty() && !_store->write(changes))
+    {
+        // 写入失败：重新标记，下次重试
+        for (const MetaChange &c : changes)
+        {
+            Shard &shard = shardOf(c.rel);
+            Util::WRLockGuard lock(&shard.rwlock);
+            shard.pending.insert(c.rel);
+        }
+        _pending += changes.size();
         return false;
     }
-    BackupInfo *newbi = new BackupInfo(val);
-    _table[key] = std::unique_ptr<BackupInfo>(newbi);
-    storage(); // 持久化文件元信息
+
+    // 3.唤醒等待落盘的请求线程
+    return markDurable(target);
+}
+
+bool Cloud::BackupInfoManager::markDurable(uint64_t target)
+{
+    {
+        std::unique_lock<std::mutex> lck(_durable_mutex);
+        if (target > _durable_seq)
+            _durable_seq = target;
+    }
+    _durable_cond.notify_all();
     return true;
 }
 
+void Cloud::BackupInfoManager::maybeCompact()
+{
+    // 后端需要整理时压实；已有压实在进行或排队则直接返回
+    // 压实要重写快照或归并段，在io执行器中进行，触发它的请求线程（sync模式）或刷盘线程不必等待
+    if (!_store->needCheckpoint())
+        return;
+    bool expected = false;
+    if (!_compacting.compare_exchange_strong(expected, true))
+        return;
+    bool posted = ckf::ThreadPool::getInstance(ckf::ThreadPool::IO).post(ckf::ThreadPool::LV2, [this]()
+    {
+        storage();
+        _compacting = false;
+    });
+    if (!posted)
+        _compacting = false; // io执行器已停止：留到下次启动时整理
+}
+
+bool Cloud::BackupInfoManager::insert(const std::string &key, const BackupInfo &val)
+{
+    if (val.url() != key)
+    {
+        DF_WARN("BackupInfo key mismatch")
+        return false;
+    }
+
+    Shard &shard = shardOf(val.rel_path);
+    uint64_t seq = 0;
+    {
+        Util::WRLockGuard lock(&shard.rwlock); // 分片写锁，只阻塞同一分片的读写
+
+        if (findLocked(shard, val.rel_path)) // 已存在
+        {
+            DF_WARN("BackupInfo exists")
+            return false;
+        }
+        BackupInfo::Ptr bi = std::make_shared<const BackupInfo>(val);
+        if (!logChange({MetaChange{val.rel_path, bi}}, &seq)) // 先记录本次修改，再修改内存表
+            return false;
+        putLocked(shard, bi);
+    }
+    return commitChange(seq);
+}
+
 // 有则替换，无则插入
 bool Cloud::BackupInfoManager::update(const std::string &key, const BackupInfo &val)
 {
-    Util::WRLockGuard(&this->_rwlock); // 读写锁，不能并行读写
+    if (val.url() != key)
+    {
+        DF_WARN("BackupInfo key mismatch")
+        return false;
+    }
 
-    if (_table.count(key) == 0) // 不存在
+    Shard &shard = shardOf(val.rel_path);
+    uint64_t seq = 0;
     {
-        _table[key] = std::unique_ptr<BackupInfo>(new BackupInfo(val));
+        Util::WRLockGuard lock(&shard.rwlock); // 分片写锁，只阻塞同一分片的读写
+
+        BackupInfo::Ptr bi = std::make_shared<const BackupInfo>(val);
+        if (!logChange({MetaChange{val.rel_path, bi}}, &seq)) // 先记录本次修改，再修改内存表
+            return false;
+        putLocked(shard, bi);
     }
-    else // 存在
+    return commitChange(seq);
+}
+
+bool Cloud::BackupInfoManager::updateIfExists(const std::string &key, const BackupInfo &val)
+{
+    if (val.url() != key)
     {
-        *_table[key] = val;
+        DF_WARN("BackupInfo key mismatch")
+        return false;
     }
-    storage(); // 持久化文件元信息
-    return true;
+
+    Shard &shard = shardOf(val.rel_path);
+    uint64_t seq = 0;
+    {
+        Util::WRLockGuard lock(&shard.rwlock); // 分片写锁，只阻塞同一分片的读写
+
+        if (!findLocked(shard, val.rel_path)) // 已被删除或改名
+        {
+            DF_WARN("BackupInfo not exists")
+            return false;
+        }
+        BackupInfo::Ptr bi = std::make_shared<const BackupInfo>(val);
+        if (!logChange({MetaChange{val.rel_path, bi}}, &seq)) // 先记录本次修改，再修改内存表
+            return false;
+        putLocked(shard, bi);
+    }
+    return commitChange(seq);
 }
 
-bool Cloud::BackupInfoManager::getOneByURL(const std::string &url, BackupInfo *val)
+bool Cloud::BackupInfoManager::finishPacking(const BackupInfo &val)
+{
+    Shard &shard = shardOf(val.rel_path);
+    uint64_t seq = 0;
+    {
+        Util::WRLockGuard lock(&shard.rwlock); // 与上传的update互斥，比较和替换之间记录不会变化
+
+        auto it = shard.table.find(val.rel_path);
+        if (it == shard.table.end() || !it->second->is_packing ||
+            it->second->mtime != val.mtime || it->second->fsize != val.fsize)
+        {
+            _logger->_debug("%s: 压缩期间记录已改变, 放弃压缩结果", val.rel_path.c_str());
+            return false;
+        }
+        BackupInfo::Ptr bi = std::make_shared<const BackupInfo>(val);
+        if (!logChange({MetaChange{val.rel_path, bi}}, &seq)) // 先记录本次修改，再修改内存表
+        {
+            // 写入失败：压缩结果作废，只在内存中清除压缩标志，hot_time之后重试；
+            // 不清除的话该文件既不会再被压缩，也无法删除和改名
+            BackupInfo retry = *it->second;
+            retry.is_packing = false;
+            retry.atime = time(nullptr);
+            putLocked(shard, std::make_shared<const BackupInfo>(retry));
+            return false;
+        }
+        putLocked(shard, bi);
+
+        // 删除失败时留给启动时的一致性检查处理
+        if (bi->pack_flag)
+            Util::FileUtil(bi->realPath()).remove();
+    }
+    return commitChange(seq);
+}
+
+void Cloud::BackupInfoManager::cancelPacking(const std::string &url)
 {
-    Util::RDLockGuard(&this->_rwlock); //读锁，可以并行读
+    std::string_view rel;
+    if (!PathLayout::get().relOfURL(url, &rel))
+        return;
+
+    Shard &shard = shardOf(rel);
+    Util::WRLockGuard lock(&shard.rwlock);
+    auto it = shard.table.find(rel);
+    if (it == shard.table.end() || !it->second->is_packing)
+        return;
+
+    // is_packing是运行时状态，不持久化，只替换内存中的记录；上传完成的update会重新调度，
+    // 在此之前不调度，避免旧的压缩还没结束就再次开始压缩
+    BackupInfo val = *it->second;
+    val.is_packing = false;
+    putLocked(shard, std::make_shared<const BackupInfo>(val));
+    _cold_timer.cancel(val.rel_path);
+}
+
+bool Cloud::BackupInfoManager::remove(const std::string &url, std::vector<std::string> *trash)
+{
+    std::string_view rel;
+    if (!PathLayout::get().relOfURL(url, &rel))
+        return false;
 
-    if (_table.count(url) == 0) // 不存在
+    Shard &shard = shardOf(rel);
+    uint64_t seq = 0;
     {
-        DF_WARN("BackupInfo not exists")
+        Util::WRLockGuard lock(&shard.rwlock); // 分片写锁，只阻塞同一分片的读写
+
+        BackupInfo::Ptr old = findLocked(shard, rel);
+        if (!old) // 不存在
+        {
+            DF_WARN("BackupInfo not exists")
+            return false;
+        }
+        if (old->is_packing) // 正在压缩，压缩线程稍后会写回元信息
+        {
+            DF_WARN("BackupInfo is packing")
+            return false;
+        }
+
+        // 1.磁盘文件移入回收目录；在锁内完成，之后同名文件的重新上传不会被回收任务误删
+        std::vector<std::string> moved;
+        for (const std::string &path : {old->realPath(), old->packPath()})
+        {
+            if (!Util::FileUtil(path).isExists())
+                continue;
+            std::string dst = trashPathOf(*old, path);
+            if (::rename(path.c_str(), dst.c_str()) < 0)
+            {
+                DF_ERROR("%s: Move to trash failed", path.c_str());
+                for (size_t i = 0; i < moved.size(); i += 2) // 已移走的放回原处
+                    ::rename(moved[i + 1].c_str(), moved[i].c_str());
+                return false;
+            }
+            moved.push_back(path);
+            moved.push_back(dst);
+        }
+
+        // 2.记录墓碑，失败时文件放回原处；之后再删除表项
+        std::string key = old->rel_path;
+        if (!logChange({MetaChange{key, nullptr}}, &seq))
+        {
+            for (size_t i = 0; i < moved.size(); i += 2)
+                ::rename(moved[i + 1].c_str(), moved[i].c_str());
+            return false;
+        }
+        for (size_t i = 1; i < moved.size(); i += 2)
+            trash->push_back(moved[i]);
+        eraseLocked(shard, key);
+    }
+    return commitChange(seq);
+}
+
+bool Cloud::BackupInfoManager::rename(const std::string &url, const std::string &newURL)
+{
+    std::string_view oldRel, newRel;
+    if (!PathLayout::get().relOfURL(url, &oldRel) || !PathLayout::get().relOfURL(newURL, &newRel))
         return false;
+
+    // 新旧名字可能在不同分片：按分片地址顺序加锁，避免反方向的改名互相死锁
+    Shard &from = shardOf(oldRel);
+    Shard &to = shardOf(newRel);
+    uint64_t seq = 0;
+    {
+        Util::WRLockGuard lock(&(&from < &to ? from : to).rwlock);
+        std::optional<Util::WRLockGuard> lock2;
+        if (&from != &to)
+            lock2.emplace(&(&from < &to ? to : from).rwlock);
+
+        BackupInfo::Ptr old = findLocked(from, oldRel);
+        if (!old) // 不存在
+        {
+            DF_WARN("BackupInfo not exists")
+            return false;
+        }
+        if (findLocked(to, newRel)) // 新名字已存在
+        {
+            DF_WARN("BackupInfo exists")
+            return false;
+        }
+        if (old->is_packing)
+        {
+            DF_WARN("BackupInfo is packing")
+            return false;
+        }
+
+        // 1.磁盘文件改名（未压缩的是备份文件，已压缩的是压缩包）
+        BackupInfo val = *old;
+        val.rel_path = std::string(newRel);
+        std::string src = old->pack_flag ? old->packPath() : old->realPath();
+        std::string dst = old->pack_flag ? val.packPath() : val.realPath();
+        if (Util::FileUtil(dst).isExists() || ::rename(src.c_str(), dst.c_str()) < 0)
+        {
+            DF_ERROR("%s: Rename to %s failed", src.c_str(), dst.c_str());
+            return false;
+        }
+
+        // 2.新记录和墓碑作为一批写入，新记录在前：日志尾部残缺时只会多出旧名字的记录，而不会丢失记录
+        //   （启动时的检查会删除没有文件的记录）；写入失败时磁盘文件改回原名
+        std::string oldKey = old->rel_path;
+        BackupInfo::Ptr bi = std::make_shared<const BackupInfo>(val);
+        if (!logChange({MetaChange{val.rel_path, bi}, MetaChange{oldKey, nullptr}}, &seq))
+        {
+            ::rename(dst.c_str(), src.c_str());
+            return false;
+        }
+        eraseLocked(from, oldKey);
+        putLocked(to, bi);
     }
+    return commitChange(seq);
+}
 
-    *val = *_table[url].get();
+bool Cloud::BackupInfoManager::getOneByURL(const std::string &url, BackupInfo *val)
+{
+    BackupInfo::Ptr bi = getOneByURL(url);
+    if (!bi)
+        return false;
+    *val = *bi;
     return true;
 }
 
 bool Cloud::BackupInfoManager::getOneByRealPath(const std::string &realPath, BackupInfo *val)
 {
-    Util::RDLockGuard(&this->_rwlock);//读锁，可以并行读
+    BackupInfo::Ptr bi = getOneByRealPath(realPath);
+    if (!bi)
+        return false;
+    *val = *bi;
+    return true;
+}
+
+bool Cloud::BackupInfoManager::getOneByPackPath(const std::string &packPath, BackupInfo *val)
+{
+    BackupInfo::Ptr bi = getOneByPackPath(packPath);
+    if (!bi)
+        return false;
+    *val = *bi;
+    return true;
+}
 
-    for (auto &[k, v] : _table)
+bool Cloud::BackupInfoManager::getAll(std::vector<BackupInfo> *array)
+{
+    std::vector<BackupInfo::Ptr> views;
+    getAll(&views);
+
+    array->reserve(array->size() + views.size());
+    for (auto &v : views)
     {
-        if (v->real_path == realPath)
+        (*array).push_back(*v);
+    }
+    return true;
+}
+
+Cloud::BackupInfo::Ptr Cloud::BackupInfoManager::findByRel(std::string_view rel)
+{
+    Shard &shard = shardOf(rel);
+    Util::RDLockGuard lock(&shard.rwlock); //读锁，可以并行读
+    return findLocked(shard, rel);
+}
+
+Cloud::BackupInfo::Ptr Cloud::BackupInfoManager::findLocked(Shard &shard, std::string_view rel)
+{
+    auto it = shard.table.find(rel);
+    if (it != shard.table.end())
+        return it->second;
+    // 后端带索引时表中只有正在压缩的记录，其余到后端查找（先查布隆过滤器，大多数不存在的段不读）
+    return _resident ? nullptr : _store->get(rel);
+}
+
+// url、real_path、pack_path去掉前缀（和后缀）即为相对路径，直接定位表项
+Cloud::BackupInfo::Ptr Cloud::BackupInfoManager::getOneByURL(const std::string &url)
+{
+    std::string_view rel;
+    BackupInfo::Ptr bi;
+    if (PathLayout::get().relOfURL(url, &rel))
+        bi = findByRel(rel);
+    if (!bi)
+        DF_WARN("BackupInfo not exists")
+    return bi;
+}
+
+Cloud::BackupInfo::Ptr Cloud::BackupInfoManager::getOneByRealPath(const std::string &realPath)
+{
+    std::string_view rel;
+    if (!PathLayout::get().relOfRealPath(realPath, &rel))
+        return nullptr;
+    return findByRel(rel);
+}
+
+Cloud::BackupInfo::Ptr Cloud::BackupInfoManager::getOneByPackPath(const std::string &packPath)
+{
+    std::string_view rel;
+    if (!PathLayout::get().relOfPackPath(packPath, &rel))
+        return nullptr;
+    return findByRel(rel);
+}
+
+bool Cloud::BackupInfoManager::getAll(std::vector<BackupInfo::Ptr> *array)
+{
+    if (!_resident)
+    {
+        std::vector<BackupInfo::Ptr> records;
+        _store->scan("", "", 0, &records);
+        overlayPacking(&records);
+        array->insert(array->end(), records.begin(), records.end());
+        return true;
+    }
+
+    for (size_t i = 0; i < shard_num; i++)
+    {
+        Util::RDLockGuard lock(&_shards[i].rwlock);//读锁，可以并行读
+
+        for (auto &[k, v] : _shards[i].table)
         {
-            *val = *v.get();
+            (*array).push_back(v);
+        }
+    }
+    return true;
+}
+
+bool Cloud::BackupInfoManager::getPageByUser(int userID, const std::string &after, size_t offset, size_t limit, SortKey key, bool desc,
+                                             std::vector<BackupInfo::Ptr> *array, size_t *total, std::string *next)
+{
+    next->clear();
+    if (!_resident)
+        return getPageFromStore(userID, after, offset, limit, key, desc, array, total, next);
+
+    // 1.在用户索引中取出这一页的相对路径（拷贝出来，释放用户索引锁后记录可能被替换）
+    std::vector<std::string> rels;
+    {
+        UserShard &us = userShardOf(userID);
+        Util::RDLockGuard lock(&us.rwlock);//读锁，可以并行读
+
+        auto idx = us.index.find(userID);
+        if (idx == us.index.end()) // 该用户还没有文件
+        {
+            *total = 0;
             return true;
         }
+
+        const UserIndex &ui = idx->second;
+        *total = ui.by_name.size();
+        bool ok;
+        switch (key)
+        {
+        case SORT_BY_MTIME:
+            ok = collectPage(ui.by_mtime, after, offset, limit, desc, &rels, next);
+            break;
+        case SORT_BY_SIZE:
+            ok = collectPage(ui.by_size, after, offset, limit, desc, &rels, next);
+            break;
+        default:
+            ok = collectPage(ui.by_name, after, offset, limit, desc, &rels, next);
+            break;
+        }
+        if (!ok)
+        {
+            _logger->_debug("分页游标不合法: %s", after.c_str());
+            return false;
+        }
     }
-    return false;
+
+    // 2.逐个到所在分片取文件数据（期间被并发删除的跳过）
+    array->reserve(array->size() + rels.size());
+    for (const std::string &rel : rels)
+    {
+        BackupInfo::Ptr bi = findByRel(rel);
+        if (bi)
+            array->push_back(bi);
+    }
+    return true;
 }
 
-bool Cloud::BackupInfoManager::getAll(std::vector<BackupInfo> *array)
+bool Cloud::BackupInfoManager::getPageFromStore(int userID, const std::string &after, size_t offset, size_t limit, SortKey key, bool desc,
+                                                std::vector<BackupInfo::Ptr> *array, size_t *total, std::string *next)
+{
+    // 1.相对路径以用户目录开头，按前缀扫描即得该用户的全部记录（按相对路径有序）
+    char prefix[16];
+    snprintf(prefix, sizeof(prefix), "%05d/", userID); // UserManager::getDirName
+    std::vector<BackupInfo::Ptr> records;
+    _store->scan(prefix, "", 0, &records);
+    overlayPacking(&records);
+    *total = records.size();
+
+    // 2.按排序字段临时建立有序索引，复用collectPage取出这一页的相对路径
+    std::vector<std::string> rels;
+    auto collectBy = [&](auto entryOf)
+    {
+        SortedIndex<decltype(entryOf(*records.front()))> index;
+        index.items.reserve(records.size());
+        for (const BackupInfo::Ptr &bi : records)
+            index.items.push_back(entryOf(*bi));
+        std::sort(index.items.begin(), index.items.end());
+        return collectPage(index, after, offset, limit, desc, &rels, next);
+    };
+    bool ok;
+    switch (key)
+    {
+    case SORT_BY_MTIME:
+        ok = collectBy([](const BackupInfo &bi)
+                       { return std::pair<time_t, std::string_view>(bi.mtime, bi.rel_path); });
+        break;
+    case SORT_BY_SIZE:
+        ok = collectBy([](const BackupInfo &bi)
+                       { return std::pair<size_t, std::string_view>(bi.fsize, bi.rel_path); });
+        break;
+    default:
+        ok = collectBy([](const BackupInfo &bi)
+                       { return std::string_view(bi.rel_path); });
+        break;
+    }
+    if (!ok)
+    {
+        _logger->_debug("分页游标不合法: %s", after.c_str());
+        return false;
+    }
+
+    // 3.这一页的记录直接从扫描结果中按相对路径取出
+    array->reserve(array->size() + rels.size());
+    for (const std::string &rel : rels)
+    {
+        auto it = std::lower_bound(records.begin(), records.end(), rel, [](const BackupInfo::Ptr &bi, const std::string &k)
+                                   { return bi->rel_path < k; });
+        if (it != records.end() && (*it)->rel_path == rel)
+            array->push_back(*it);
+    }
+    return true;
+}
+
+void Cloud::BackupInfoManager::overlayPacking(std::vector<BackupInfo::Ptr> *records)
+{
+    // 后端中没有is_packing标志；正在压缩的记录只有少数几条，逐条二分替换
+    for (size_t i = 0; i < shard_num; i++)
+    {
+        Util::RDLockGuard lock(&_shards[i].rwlock);
+        for (auto &[rel, bi] : _shards[i].table)
+        {
+            auto it = std::lower_bound(records->begin(), records->end(), rel, [](const BackupInfo::Ptr &r, std::string_view k)
+                                       { return r->rel_path < k; });
+            if (it != records->end() && (*it)->rel_path == rel)
+                *it = bi;
+        }
+    }
+}
+
+Cloud::DeadlineScheduler &Cloud::BackupInfoManager::coldTimer()
 {
-    Util::RDLockGuard(&this->_rwlock);//读锁，可以并行读
+    return _cold_timer;
+}
 
-    for (auto &[k, v] : _table)
+Cloud::AccessTracker &Cloud::BackupInfoManager::accessTracker()
+{
+    return _access;
+}
+
+void Cloud::BackupInfoManager::recordAccess(const BackupInfo::Ptr &bi, time_t now)
+{
+    // 到期时仍会按热度再判断一次，这里提前推迟，避免频繁下载的文件每个冷却时刻都被弹出、再次调度
+    _access.touch(bi->rel_path, now);
+    time_t cool = _access.coolAt(bi->rel_path, Config::getInstance()->getHotScore(), now);
+    if (cool > now)
+        _cold_timer.postpone(bi->rel_path, cool);
+}
+
+template <typename Index>
+bool Cloud::BackupInfoManager::collectPage(const Index &index, const std::string &after, size_t offset, size_t limit, bool desc,
+                                           std::vector<std::string> *rels, std::string *next)
+{
+    // 索引项是相对路径，或(排序值, 相对路径)；游标是上一页最后一项：相对路径，或"排序值:相对路径"
+    using Entry = typename Index::key_type;
+    constexpr bool byRel = std::is_same_v<Entry, std::string_view>;
+    auto relOf = [](const Entry &entry) -> std::string_view
+    {
+        if constexpr (byRel)
+            return entry;
+        else
+            return entry.second;
+    };
+    auto cursorOf = [](const Entry &entry) -> std::string
+    {
+        if constexpr (byRel)
+            return std::string(entry);
+        else
+            return std::to_string(entry.first) + ":" + std::string(entry.second);
+    };
+    auto parseCursor = [&after](Entry *entry) -> bool
+    {
+        if constexpr (byRel)
+        {
+            *entry = after;
+            return true;
+        }
+        else
+        {
+            size_t pos = after.find(':');
+            if (pos == 0 || pos == std::string::npos)
+                return false;
+            char *end = nullptr;
+            errno = 0;
+            long long value = std::strtoll(after.c_str(), &end, 10);
+            if (errno != 0 || end != after.c_str() + pos)
+                return false;
+            *entry = {static_cast<typename Entry::first_type>(value), std::string_view(after).substr(pos + 1)};
+            return true;
+        }
+    };
+
+    // 有游标时二分定位到游标之后的第一项，只有offset需要逐项跳过
+    auto collect = [&](auto it, auto end)
+    {
+        for (; offset > 0 && it != end; --offset)
+            ++it;
+        for (size_t n = 0; it != end && (limit == 0 || n < limit); n++, ++it)
+            rels->emplace_back(relOf(*it));
+        if (it != end && !rels->empty())
+            *next = cursorOf(*std::prev(it));
+    };
+
+    Entry key{};
+    if (!after.empty() && !parseCursor(&key))
+        return false;
+
+    if (desc)
+    {
+        // 降序时游标之后是比游标小的项：lower_bound之前的那一项开始倒着走
+        auto from = after.empty() ? index.rbegin() : std::make_reverse_iterator(index.lower_bound(key));
+        collect(from, index.rend());
+    }
+    else
     {
-        (*array).push_back(*v.get());
+        auto from = after.empty() ? index.begin() : index.upper_bound(key);
+        collect(from, index.end());
     }
     return true;
 }
@@ -2,149 +2,347 @@
 #include "util.hh"
 #include "config.hh"
 #include "data.hh"
-#include "threadpool.hh"
+#include "compress.hh"
+#include "metrics.hh"
+#include <unordered_map>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 
 extern Cloud::BackupInfoManager *_biManager;
 extern ckflogs::Logger::Ptr _logger;
 
 namespace Cloud
 {
-    // 获取备份文件夹目录，遍历其中所有备份文件，对每一个备份文件进行热点判断
-    // 热点判断：当前时间 与 文件最近一次修改时间的差值，是否小于热点时间，是则为热点文件
+    // 热点判断：当前时间 与 文件最近一次修改/访问时间的差值，是否小于热点时间，是则为热点文件；
+    // 超过热点时间但下载热度（衰减计数）仍不低于hot_score的文件，也暂不压缩
     // 若备份文件是非热点文件，对其进行压缩，删除原文件，修改备份数据pack_flag
+    //
+    // 不逐个文件反复判断：每次修改备份信息（上传、改名、压缩）时，数据管理模块按冷却时刻调度该文件；
+    // 主循环poll等待调度器的eventfd和inotify，只在最早的冷却时刻到达时醒来
+    // inotify监听backup_dir及各用户目录，捕获不经过服务写入的修改
 
     class HotManager // 热点管理器
     {
     public:
         HotManager();
-        bool run(); // 运行热点管理器
+        ~HotManager();
+        bool run();  // 运行热点管理器，stop之后返回
+        void stop(); // 通知run返回（可在其它线程、run开始之前调用），之后不再提交新的压缩
 
     private:
-        bool isHot(const std::string &realPath);           // 热点判断
-        bool NotHotHandler(Cloud::BackupInfo backupInfo); // 非热点文件的处理函数
+        bool isHot(const BackupInfo &bi);                  // 热点判断
+        void NotHotHandler(const BackupInfo &bi, bool ok); // 非热点文件压缩结束后的处理函数（压缩调度器的工作线程中调用）
+
+        bool watchDir(const std::string &path, bool isRoot); // 监听目录（根目录关注新建的用户目录，用户目录关注文件写入）
+        void scanDir(const std::string &path);             // 监听已有的用户目录（启动、新建目录、事件溢出时）
+        void handleEvents();                               // 读取并处理inotify事件
+        void touched(const std::string &realPath);         // 文件在磁盘上被修改：按磁盘mtime推迟冷却时刻
+        void expire(const std::string &url);               // 冷却时刻已到：再次确认后交给线程池压缩
+
+    private:
+        int _inotify_fd;
+        int _stop_fd;       // stop写入，run的poll随之返回
+        std::atomic<bool> _stopping;
+        std::string _backup_dir;
+        std::unordered_map<int, std::string> _watch_dirs; // wd -> 目录路径（以'/'结尾）
+
+        // 指标：用于按实际负载调整hot_time
+        Histogram &_expired_per_pass; // 每次醒来处理的到期文件数
+        Histogram &_cold_lag;         // 冷却时刻到达 -> 交给压缩调度器的延迟（秒）
+        Counter &_scanned;            // 目录扫描检查的文件数（启动、新建目录、事件溢出）
+        Counter &_events;             // 处理的inotify文件事件数
+        Counter &_deferred;           // 因下载热度推迟压缩的次数
+        Counter &_submitted;          // 交给压缩调度器的文件数
     };
 }
 
 Cloud::HotManager::HotManager()
+    : _inotify_fd(-1),
+      _stop_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+      _stopping(false),
+      _backup_dir(Config::getInstance()->getBackupDir()),
+      _expired_per_pass(Metrics::getInstance().histogram("cloud_hot_expired_per_pass", "Cold deadlines handled per wakeup",
+                                                          {1, 2, 5, 10, 50, 100, 500, 1000, 5000})),
+      _cold_lag(Metrics::getInstance().histogram("cloud_hot_cold_lag_seconds", "Delay from cold deadline to compression submit",
+                                                 {0.5, 1, 2, 5, 10, 30, 60, 300, 1800, 3600})),
+      _scanned(Metrics::getInstance().counter("cloud_hot_scanned_files_total", "Files checked by directory scans")),
+      _events(Metrics::getInstance().counter("cloud_hot_inotify_events_total", "File events read from inotify")),
+      _deferred(Metrics::getInstance().counter("cloud_hot_deferred_total", "Compressions deferred by download score")),
+      _submitted(Metrics::getInstance().counter("cloud_hot_submitted_total", "Cold files submitted for compression"))
+{
+    if (!_backup_dir.empty() && _backup_dir.back() != '/')
+        _backup_dir.push_back('/');
+
+    Metrics::getInstance().gauge("cloud_hot_cold_pending", "Uncompressed files waiting for their cold deadline", []()
+                                 { return (double)_biManager->coldTimer().size(); });
+}
+
+Cloud::HotManager::~HotManager()
+{
+    if (_inotify_fd >= 0)
+        ::close(_inotify_fd);
+    if (_stop_fd >= 0)
+        ::close(_stop_fd);
+}
+
+void Cloud::HotManager::stop()
 {
+    _stopping = true;
+    uint64_t one = 1;
+    if (_stop_fd >= 0)
+        (void)::write(_stop_fd, &one, sizeof(one));
 }
 
 // 运行热点管理模块
 bool Cloud::HotManager::run()
 {
-    //不断扫描backup_dir文件夹中
-    //发现非热点文件，进行压缩
+    // 1.等待备份文件目录backup_dir被创建
+    Util::FileUtil dir(_backup_dir);
+    while (!dir.isExists())
+    {
+        if (_stopping)
+            return true;
+        sleep(1);
+    }
 
-    // 1.获取备份文件目录
-    Util::FileUtil dir(Config::getInstance()->getBackupDir());
+    // 2.监听备份目录；已有文件在备份信息加载时就已按冷却时刻调度
+    _inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_inotify_fd < 0)
+    {
+        _logger->_error("inotify初始化失败: %s", strerror(errno));
+        return false;
+    }
+    if (!watchDir(_backup_dir, true))
+        return false;
+    scanDir(_backup_dir);
 
-    //等待备份文件目录backup_dir被创建
-    while(!dir.isExists()){
-        sleep(1);
+    DeadlineScheduler &timer = _biManager->coldTimer();
+    _logger->_debug("热点管理模块启动, 监听目录 %d 个, 待冷却文件 %d 个", _watch_dirs.size(), timer.size());
+
+    struct pollfd pfds[3];
+    pfds[0].fd = _inotify_fd;
+    pfds[0].events = POLLIN;
+    pfds[1].fd = timer.fd();
+    pfds[1].events = POLLIN;
+    pfds[2].fd = _stop_fd;
+    pfds[2].events = POLLIN;
+    std::vector<DeadlineScheduler::Key> expired;
+    while (!_stopping)
+    {
+        // 3.等待inotify事件、更早的冷却时刻，或者最早的冷却时刻到达
+        int timeout = -1;
+        time_t next = timer.nextDeadline();
+        if (next != 0)
+        {
+            time_t wait = next - time(nullptr);
+            timeout = wait <= 0 ? 0 : (int)std::min<time_t>(wait, 3600) * 1000;
+        }
+        int n = poll(pfds, 3, timeout);
+        if (n < 0 && errno != EINTR)
+        {
+            _logger->_error("热点管理模块poll失败: %s", strerror(errno));
+            return false;
+        }
+        if (_stopping)
+            break;
+        if (n > 0 && (pfds[0].revents & POLLIN))
+            handleEvents();
+        if (n > 0 && (pfds[1].revents & POLLIN))
+        {
+            uint64_t cnt;
+            (void)::read(timer.fd(), &cnt, sizeof(cnt)); // 清零，下一轮按新的最早时刻等待
+        }
+
+        // 4.处理所有已到期的文件
+        timer.popExpired(time(nullptr), &expired);
+        if (!expired.empty())
+            _expired_per_pass.observe(expired.size());
+        for (const DeadlineScheduler::Key &rel : expired)
+        {
+            if (_stopping) // 没有处理的文件下次启动时按元信息重新调度
+                break;
+            expire(PathLayout::get().url_prefix + *rel);
+        }
+        expired.clear();
     }
+    _logger->_info("热点管理模块停止");
+    return true;
+}
 
-    std::vector<std::string> backupDirs;
-    while (true)
+bool Cloud::HotManager::watchDir(const std::string &path, bool isRoot)
+{
+    uint32_t mask = isRoot ? (IN_CREATE | IN_MOVED_TO | IN_ONLYDIR)
+                           : (IN_CLOSE_WRITE | IN_MOVED_TO | IN_ATTRIB | IN_ONLYDIR);
+    int wd = inotify_add_watch(_inotify_fd, path.c_str(), mask);
+    if (wd < 0)
     {
-        // 2.获取backup_dir中的所有子目录
-        dir.scanDirectory(backupDirs);
-        if (backupDirs.empty())
+        _logger->_warn("监听目录失败 %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    _watch_dirs[wd] = path.back() == '/' ? path : path + "/";
+    return true;
+}
+
+void Cloud::HotManager::scanDir(const std::string &path)
+{
+    std::vector<std::string> entries;
+    Util::FileUtil(path).scanDirectory(entries);
+    for (const std::string &entry : entries)
+    {
+        if (Util::fs::is_directory(entry))
+            watchDir(entry, false);
+        else if (path != _backup_dir)
         {
-            usleep(1000);
-            continue;
+            _scanned.inc();
+            touched(entry);
         }
+    }
+}
 
-        // 3.遍历每个子目录的每一个文件的路径
-        std::vector<std::string> backups;
-        for (const std::string &backupDir : backupDirs)
+void Cloud::HotManager::handleEvents()
+{
+    alignas(struct inotify_event) char buf[4096];
+    while (true)
+    {
+        ssize_t len = read(_inotify_fd, buf, sizeof(buf));
+        if (len <= 0)
+            return; // EAGAIN：事件已读完
+
+        for (char *p = buf; p < buf + len;)
         {
-            Util::FileUtil subDir(backupDir);
-            subDir.scanDirectory(backups);
-            
-            for (const std::string &backupPath : backups)
+            struct inotify_event *ev = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW)
             {
-                // 获取备份信息
-                BackupInfo bi;
-                _biManager->getOneByRealPath(backupPath, &bi);
-                
-                // if (_biManager->getOneByRealPath(backupPath, &bi) == false)
-                // {
-                //     // 备份信息不存在
-                //     bi = BackupInfo(backupPath);
-                // }
-
-                // 三种情况，不用处理
-                // 文件不存在 or 正在进行压缩 or 是热点文件
-
-                // 为什么遍历到文件，文件还可能出现不存在的情况？
-                // 因为这里获取完备份信息bi（副本）时，可能刚好bi (本体) 被（处理压缩工作的线程）修改了
-                // 即文件异步压缩完成，从backup_dir中删除，所以文件不存在于扫描的文件夹中了
-
-                if (!Util::FileUtil(backupPath).isExists() || bi.is_packing || isHot(backupPath))
+                // 事件队列溢出，可能丢失了事件：重新扫描一次
+                _logger->_warn("inotify事件队列溢出, 重新扫描 %s", _backup_dir.c_str());
+                for (auto &[wd, dirPath] : _watch_dirs)
                 {
-                    continue;
+                    if (dirPath != _backup_dir)
+                        scanDir(dirPath);
                 }
+                scanDir(_backup_dir);
+                continue;
+            }
+            if (ev->mask & IN_IGNORED)
+            {
+                _watch_dirs.erase(ev->wd);
+                continue;
+            }
 
-                // 进入非热点文件的处理
-                bi.is_packing = true;
-                if (_biManager->update(bi.url, bi))
-                {
-                    // 异步处理：将非热点文件处理工作（包括压缩、删除）交给线程池，由线程池中的工作线程处理压缩逻辑
-                    auto func = std::bind(&Cloud::HotManager::NotHotHandler, this, std::placeholders::_1);
-                    auto ret = ckf::ThreadPool::getInstance().submit(ckf::ThreadPool::LV1, func, bi);
-                }
+            auto it = _watch_dirs.find(ev->wd);
+            if (it == _watch_dirs.end() || ev->len == 0)
+                continue;
+            std::string path = it->second + ev->name;
+
+            if (ev->mask & IN_ISDIR)
+            {
+                // 新的用户目录（注册时创建）
+                if (it->second == _backup_dir && watchDir(path, false))
+                    scanDir(path);
+                continue;
             }
-            backups.clear();
+            _events.inc();
+            touched(path);
         }
-
-        backupDirs.clear();
-        usleep(1000);
     }
-    return true;
 }
 
-bool Cloud::HotManager::NotHotHandler(Cloud::BackupInfo bi)
+void Cloud::HotManager::touched(const std::string &realPath)
 {
-    _logger->_debug("非热点文件 %s, 开始处理", bi.real_path.c_str());
-    time_t begin = time(nullptr);
+    // 没有备份信息（正在上传，上传完成时会被调度）or 已压缩 or 正在压缩：不处理
+    BackupInfo::Ptr bi = _biManager->getOneByRealPath(realPath);
+    if (!bi || bi->pack_flag || bi->is_packing)
+        return;
 
-    Util::FileUtil fu(bi.real_path);
+    Util::FileUtil fu(realPath);
+    if (bi->codec == BackupInfo::CODEC_SKIP && fu.lastModTime() <= bi->mtime)
+        return; // 不可压缩，且抽样之后没有被修改过
+    time_t diskCold = fu.lastModTime() + Config::getInstance()->getHotTime() + 1;
+    _biManager->coldTimer().schedule(DeadlineScheduler::keyOf(bi), std::max(bi->coldTime(), diskCold));
+}
 
-    // 1.压缩，并放入压缩包文件夹
-    if (!fu.compress(bi.pack_path))
-        return false;
+void Cloud::HotManager::expire(const std::string &url)
+{
+    // 三种情况，不用处理
+    // 没有备份信息（刚被改名/删除） or 已压缩 or 正在进行压缩
+    BackupInfo::Ptr cur = _biManager->getOneByURL(url);
+    if (!cur || cur->pack_flag || cur->is_packing)
+        return;
+    BackupInfo bi = *cur;
 
-    // 2.修改备份信息
-    bi.pack_flag = true;
+    // 到期前在磁盘上被修改过：按新的mtime重新调度
+    if (isHot(bi))
+    {
+        touched(bi.realPath());
+        return;
+    }
 
-    // 3.删除原备份文件
-    if (!fu.remove())
-        return false;
+    // 很久没有修改，但仍被频繁下载：压缩后每次下载都要解压，推迟到下载热度衰减之后
+    time_t now = time(nullptr);
+    time_t cool = _biManager->accessTracker().coolAt(cur->rel_path, Config::getInstance()->getHotScore(), now);
+    if (cool > now)
+    {
+        _deferred.inc();
+        _biManager->coldTimer().schedule(DeadlineScheduler::keyOf(cur), cool);
+        return;
+    }
 
-    // 4.压缩工作结束
-    bi.is_packing = false;
+    // 进入非热点文件的处理
+    bi.is_packing = true;
+    if (_biManager->updateIfExists(bi.url(), bi))
+    {
+        // 异步处理：交给压缩调度器按大小和等待时间排序、分块并行压缩，结束后删除原文件、更新备份信息
+        _submitted.inc();
+        _cold_lag.observe(now > bi.coldTime() ? now - bi.coldTime() : 0);
+        _logger->_debug("非热点文件 %s, 开始处理", bi.realPath().c_str());
+        auto func = std::bind(&Cloud::HotManager::NotHotHandler, this, std::placeholders::_1, std::placeholders::_2);
+        Compressor::getInstance().submit(bi, func);
+    }
+}
 
-    // 5.更新备份信息
-    _biManager->update(bi.url, bi);
+void Cloud::HotManager::NotHotHandler(const BackupInfo &packed, bool ok)
+{
+    BackupInfo bi = packed;
 
-    time_t end = time(nullptr);
-    _logger->_debug("非热点文件 %s, 处理成功 - 用时: %d", bi.pack_path.c_str(), end - begin);
-    return true;
+    // 1.压缩失败，或抽样判断为不可压缩（文件留在backup_dir，内容修改之前不再调度）
+    if (!ok || bi.codec == BackupInfo::CODEC_SKIP)
+    {
+        // 清除压缩标志，否则该文件既不会再被压缩，也无法删除和改名；压缩失败时hot_time之后重试
+        // 压缩期间被重新上传时新记录已不在压缩中，写回会失败，以新记录为准
+        bi.is_packing = false;
+        if (!ok)
+        {
+            bi.atime = time(nullptr);
+            bi.codec = bundle::RAW;
+        }
+        _biManager->finishPacking(bi);
+        return;
+    }
+
+    // 2.压缩包已落盘：先把元信息改为已压缩，再删除原文件（finishPacking在分片锁内完成）
+    // 任何时刻崩溃，磁盘上都至少有一份完整的数据，启动时按元信息清理多余的一份
+    bi.pack_flag = true;
+    bi.is_packing = false;
+    if (!_biManager->finishPacking(bi))
+    {
+        // 元信息没有写入：压缩期间文件被重新上传（压缩包是旧内容），或写入失败（finishPacking已清除压缩标志，稍后重试）；
+        // 保留原文件，丢弃压缩包
+        Util::FileUtil(bi.packPath()).remove();
+        return;
+    }
+
+    _logger->_debug("非热点文件 %s, 处理成功", bi.packPath().c_str());
 }
 
-bool Cloud::HotManager::isHot(const std::string &realPath) // 判断path是否为热点文件
+bool Cloud::HotManager::isHot(const BackupInfo &bi) // 判断文件是否为热点文件
 {
-    // 1.获取热点时间
-    time_t hot_time = Config::getInstance()->getHotTime();
-    // 2.获取文件的最近访问时间
-    Util::FileUtil fu(realPath);
-    time_t mtime = fu.lastModTime();
-
-    // 3.获取当前时间
-    time_t cur_time = std::time(nullptr);
-    // 4.判断
-    if (cur_time - mtime <= hot_time)
-        return true;
-    else
-        return false;
-}
\ No newline at end of file
+    // 1.冷却时刻：备份信息中最近修改/访问时间 与 磁盘上的最近修改时间，取较晚者
+    Util::FileUtil fu(bi.realPath());
+    time_t cold = std::max(bi.coldTime(), fu.lastModTime() + Config::getInstance()->getHotTime() + 1);
+
+    // 2.当前时间还没到冷却时刻，就是热点文件
+    return std::time(nullptr) < cold;
+}
@@ -0,0 +1,263 @@
+#pragma once
+#include <functional>
+#include <mutex>
+#include "util.hh"
+
+namespace Cloud
+{
+    // 备份信息追加日志（write-ahead log）
+    // 每次修改只追加一行记录并fdatasync，写入代价与文件总数无关
+    // 记录格式：每行一个紧凑的Json对象 {"op":"put","info":{...}} 或 {"op":"del","url":"..."}
+    // 崩溃时最后一行可能不完整，回放时丢弃并截断
+    class Journal
+    {
+    public:
+        using Replayer = std::function<void(const Json::Value &record)>;
+
+        struct Mark // 日志中的一个位置：此前的字节数和记录数
+        {
+            size_t size;
+            size_t records;
+        };
+
+        Journal(const std::string &path);
+        ~Journal();
+
+        bool open();                          // 打开（或创建）日志文件
+        bool append(const Json::Value &record); // 追加一条记录并落盘
+        bool append(const std::vector<Json::Value> &records, bool durable = true); // 批量追加，一次write + 一次fdatasync（durable为false时不落盘）
+        bool sync();                          // 落盘此前不落盘追加的记录
+        bool replay(const Replayer &cb);      // 按顺序回放所有完整记录
+        bool reset();                         // 清空日志（快照写入成功后调用）
+        Mark mark();                          // 当前的结尾位置
+        bool reset(const Mark &upto);         // 只丢弃upto之前的记录，之后追加的保留（整理期间允许追加）
+        size_t records();                     // 当前日志中的记录数
+
+    private:
+        bool truncateLocked(); // 清空日志（调用者持有_mutex）
+        void rollbackLocked(); // 追加失败：截断回_size，丢掉写了一半的字节
+
+    private:
+        std::string _path; // 日志文件路径
+        int _fd;           // 日志文件描述符（O_APPEND）
+        size_t _size;      // 日志的字节数
+        size_t _records;   // 日志中的记录数
+        bool _broken;      // 追加失败后没能截断回去：结尾有残缺的字节，在reset重写日志之前拒绝追加
+        std::mutex _mutex; // 保证多线程追加时每行记录完整
+    };
+}
+
+Cloud::Journal::Journal(const std::string &path)
+    : _path(path), _fd(-1), _size(0), _records(0), _broken(false)
+{
+}
+
+Cloud::Journal::~Journal()
+{
+    if (_fd >= 0)
+        ::close(_fd);
+}
+
+bool Cloud::Journal::open()
+{
+    _fd = ::open(_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (_fd < 0)
+    {
+        DF_ERROR("%s: Journal open failed", _path.c_str());
+        return false;
+    }
+    struct stat st;
+    if (::fstat(_fd, &st) < 0)
+    {
+        DF_ERROR("%s: Journal stat failed", _path.c_str());
+        return false;
+    }
+    _size = st.st_size;
+    return true;
+}
+
+bool Cloud::Journal::append(const Json::Value &record)
+{
+    return append(std::vector<Json::Value>{record});
+}
+
+bool Cloud::Journal::append(const std::vector<Json::Value> &records, bool durable)
+{
+    std::string lines;
+    for (const Json::Value &record : records)
+    {
+        std::string line;
+        if (!Util::JsonUtil::serialize(record, &line, true))
+        {
+            DF_ERROR("Journal record serialize failed");
+            return false;
+        }
+        lines += line;
+        lines.push_back('\n');
+    }
+
+    std::unique_lock<std::mutex> lck(_mutex);
+    if (_broken)
+    {
+        // 残缺的字节之后再追加，回放时会连同后面的记录一起被丢弃
+        DF_ERROR("%s: Journal broken, append refused", _path.c_str());
+        return false;
+    }
+    size_t written = 0;
+    while (written < lines.size())
+    {
+        ssize_t n = ::write(_fd, lines.data() + written, lines.size() - written);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            DF_ERROR("%s: Journal write failed", _path.c_str());
+            rollbackLocked();
+            return false;
+        }
+        written += n;
+    }
+    if (durable && ::fdatasync(_fd) < 0)
+    {
+        DF_ERROR("%s: Journal fdatasync failed", _path.c_str());
+        rollbackLocked();
+        return false;
+    }
+    _size += lines.size();
+    _records += records.size();
+    return true;
+}
+
+bool Cloud::Journal::sync()
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    if (::fdatasync(_fd) < 0)
+    {
+        DF_ERROR("%s: Journal fdatasync failed", _path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool Cloud::Journal::replay(const Replayer &cb)
+{
+    Util::FileUtil fu(_path);
+    if (!fu.isExists())
+        return true;
+
+    std::string content;
+    if (!fu.getContent(content))
+    {
+        DF_ERROR("%s: Journal read failed", _path.c_str());
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lck(_mutex);
+    _records = 0;
+    size_t pos = 0, valid = 0; // valid: 最后一条完整记录的结尾
+    while (pos < content.size())
+    {
+        size_t end = content.find('\n', pos);
+        if (end == std::string::npos)
+            break; // 最后一行没有换行符，说明写入时崩溃
+
+        Json::Value record;
+        if (!Util::JsonUtil::unserialize(content.substr(pos, end - pos), &record))
+            break; // 损坏的记录，其后的内容一律丢弃
+
+        cb(record);
+        _records++;
+        pos = end + 1;
+        valid = pos;
+    }
+
+    if (valid < content.size())
+    {
+        DF_WARN("%s: Journal tail corrupted, drop %d bytes", _path.c_str(), (int)(content.size() - valid));
+        if (::truncate(_path.c_str(), valid) < 0)
+        {
+            DF_ERROR("%s: Journal truncate failed", _path.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Cloud::Journal::reset()
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    return truncateLocked();
+}
+
+Cloud::Journal::Mark Cloud::Journal::mark()
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    return Mark{_size, _records};
+}
+
+bool Cloud::Journal::reset(const Mark &upto)
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    if (upto.size >= _size)
+        return truncateLocked();
+
+    // upto之后还有记录：把它们写成新文件再原子替换，期间的追加在锁外等待
+    // 替换之前崩溃时旧日志完整保留，回放时upto之前的记录被快照之后的记录覆盖，结果不变
+    std::string tail(_size - upto.size, '\0');
+    int rfd = ::open(_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (rfd < 0 || ::pread(rfd, &tail[0], tail.size(), upto.size) != (ssize_t)tail.size())
+    {
+        DF_ERROR("%s: Journal read failed", _path.c_str());
+        if (rfd >= 0)
+            ::close(rfd);
+        return false;
+    }
+    ::close(rfd);
+
+    if (!Util::FileUtil(_path).atomicSetContent(tail))
+    {
+        DF_ERROR("%s: Journal reset failed", _path.c_str());
+        return false;
+    }
+    int fd = ::open(_path.c_str(), O_WRONLY | O_APPEND, 0644);
+    if (fd < 0)
+    {
+        DF_ERROR("%s: Journal open failed", _path.c_str());
+        return false;
+    }
+    ::close(_fd);
+    _fd = fd;
+    _size = tail.size();
+    _records -= upto.records;
+    _broken = false; // 新文件只有_size以内的完整记录
+    return true;
+}
+
+bool Cloud::Journal::truncateLocked()
+{
+    if (::ftruncate(_fd, 0) < 0 || ::fsync(_fd) < 0)
+    {
+        DF_ERROR("%s: Journal reset failed", _path.c_str());
+        return false;
+    }
+    _size = 0;
+    _records = 0;
+    _broken = false;
+    return true;
+}
+
+void Cloud::Journal::rollbackLocked()
+{
+    // 写了一半或没有落盘的记录必须去掉，否则之后追加的记录会接在残缺的行后面，回放时一起丢弃
+    if (::ftruncate(_fd, _size) < 0)
+    {
+        DF_ERROR("%s: Journal truncate failed, journal broken", _path.c_str());
+        _broken = true;
+    }
+}
+
+size_t Cloud::Journal::records()
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    return _records;
+}
@@ -0,0 +1,887 @@
+#pragma once
+#include <map>
+#include <mutex>
+#include <sys/mman.h>
+#include <cstring>
+#include "util.hh"
+
+namespace Cloud
+{
+    // 布隆过滤器：每个key约10个bit、7个哈希函数，误判率约1%
+    // 用两个哈希值模拟k个哈希函数（double hashing）
+    class BloomFilter
+    {
+    public:
+        static const size_t bits_per_key = 10;
+        static const size_t hash_num = 7;
+
+        static uint64_t hash(std::string_view key);
+        static std::string build(const std::vector<uint64_t> &hashes); // 由key的哈希值生成位数组
+        static bool mayContain(const char *bits, size_t len, uint64_t h); // false表示一定不存在
+    };
+
+    // 有序不可变段文件
+    // 文件布局：| Entry * count | 稀疏索引 | 布隆过滤器 | Footer |
+    // Entry：| EntryHead | key | Value（墓碑没有Value）|，按key升序排列
+    // 稀疏索引：每index_interval条记录一个Entry的偏移，查找时二分索引再顺序扫描
+    class Segment
+    {
+    public:
+        using Ptr = std::shared_ptr<Segment>;
+
+        struct EntryHead
+        {
+            uint32_t key_len; // key（相对路径）长度
+            uint8_t flags;    // FLAG_DELETED / FLAG_PACKED
+            uint8_t reserved[3];
+        };
+
+        struct Value
+        {
+            uint64_t fsize;
+            int64_t atime;
+            int64_t mtime;
+            int32_t userID;
+            uint8_t codec;    // 压缩算法
+            uint8_t reserved[3];
+        };
+
+        struct Footer
+        {
+            uint64_t count;       // 记录数
+            uint64_t index_off;   // 稀疏索引偏移（也是Entry区的结尾）
+            uint64_t index_count; // 稀疏索引项数
+            uint64_t bloom_off;   // 布隆过滤器偏移
+            uint64_t bloom_size;  // 布隆过滤器字节数
+            uint64_t checksum;    // Footer之前全部内容的FNV-1a校验和
+            char magic[8];        // "CLDSEG01"
+        };
+
+        struct Cursor // 指向段中的一条记录
+        {
+            size_t off;           // 本条记录偏移
+            size_t next;          // 下一条记录偏移
+            std::string_view key;
+            uint8_t flags;
+            const char *value;    // Value（墓碑为nullptr）
+        };
+
+        enum
+        {
+            FLAG_DELETED = 0x1,
+            FLAG_PACKED = 0x2
+        };
+
+        static const size_t index_interval = 16;
+
+    public:
+        Segment(const std::string &path, uint64_t id);
+        ~Segment();
+
+        bool open();                       // mmap段文件并校验
+        uint64_t id() const;
+        const std::string &path() const;
+        size_t size() const;               // 记录数
+
+        bool first(Cursor *cur) const;                     // 第一条记录，段为空时返回false
+        bool seek(std::string_view key, Cursor *cur) const; // 第一条key >= 参数的记录，没有时返回false
+        bool next(Cursor *cur) const;                      // 下一条记录，到达结尾时返回false
+        bool get(std::string_view key, uint64_t h, Cursor *cur) const; // 精确查找（h为key的BloomFilter::hash，先查布隆过滤器）
+        static void decode(const Cursor &cur, BackupInfo *bi); // 把记录还原为BackupInfo
+
+    private:
+        void parse(size_t off, Cursor *cur) const;
+
+    private:
+        std::string _path;
+        uint64_t _id;          // 段编号，越大越新
+        const char *_map;
+        size_t _map_len;
+        const Footer *_footer;
+    };
+
+    // 按key升序追加记录，生成段文件
+    class SegmentWriter
+    {
+    public:
+        SegmentWriter();
+
+        void add(std::string_view key, const BackupInfo *bi); // bi为nullptr表示墓碑
+        size_t size() const;
+        bool commit(const std::string &path);                 // 原子地写出段文件
+
+    private:
+        std::string _data;
+        std::vector<uint64_t> _index;  // 稀疏索引
+        std::vector<uint64_t> _hashes; // 全部key的哈希值，用于生成布隆过滤器
+        size_t _count;
+    };
+
+    // lsm后端：追加日志 + 内存表 + 有序不可变段文件
+    // 修改先写日志再写内存表；日志记录数达到compact_threshold时，内存表整体写成一个新段并丢弃日志中对应的记录；
+    // 段数超过max_segments时把所有段归并为一个，同时丢弃墓碑
+    // 段的清单保存在MANIFEST中，写新段 -> 原子替换MANIFEST -> 丢弃日志记录/删除旧段，任一步崩溃都可恢复
+    // 整理时锁内只把内存表换成只读内存表并记下日志位置，写段和归并都在锁外进行，期间的写入进入新的内存表
+    // 点查逐段先查布隆过滤器，前缀扫描用稀疏索引定位起点，管理器不必在内存中常驻全部记录
+    class LsmStore : public MetaStore
+    {
+    public:
+        LsmStore(const std::string &dir);
+
+        bool open(const Loader &cb) override; // cb为空时不交回数据（查询直接走本后端）
+        bool write(const std::vector<MetaChange> &changes, bool durable = true) override;
+        bool sync() override;
+        bool needCheckpoint() override;
+        bool checkpoint(const Dumper &dump) override; // 不需要内存表之外的数据，只把内存表写成段
+
+        bool indexed() override;
+        BackupInfo::Ptr get(std::string_view rel) override; // 点查：内存表 -> 只读内存表 -> 段（从新到旧，先查布隆过滤器）
+        void scan(const std::string &prefix, const std::string &after, size_t limit,
+                  std::vector<BackupInfo::Ptr> *out) override;  // 归并内存表和段，从max(prefix, after之后)开始
+
+    private:
+        using Memtable = std::map<std::string, BackupInfo::Ptr, std::less<>>; // nullptr为墓碑，可以用string_view查找
+        using Merger = std::function<bool(std::string_view key, const BackupInfo *bi)>; // 返回false时停止
+
+        // 多路归并内存表（从新到旧）和段中key >= from的部分，每个key只给出最新版本
+        static void merge(const std::vector<const Memtable *> &tables, const std::vector<Segment::Ptr> &segments,
+                          std::string_view from, const Merger &cb);
+        void mergeLocked(std::string_view from, const Merger &cb);    // 归并当前全部数据（调用者持有_mutex）
+        bool flushImmutable(const Journal::Mark &upto);               // 只读内存表 -> 新段，丢弃upto之前的日志记录
+        void thawLocked();                                            // 写段失败：只读内存表并回内存表，记录仍在日志中
+        bool mergeSegments();                                         // 全部段 -> 一个段
+        bool loadManifest();
+        bool saveManifest(const std::vector<Segment::Ptr> &segments);
+        bool importLegacy();                                          // 从旧的快照/Json备份导入（打开时调用）
+        std::string segmentPath(uint64_t id);
+
+    private:
+        std::string _dir;                    // 数据目录
+        Journal _wal;                        // 内存表对应的追加日志
+        Memtable _memtable;                  // 内存表
+        Memtable _immutable;                 // 正在写成段的只读内存表，写完之前仍参与读取
+        std::vector<Segment::Ptr> _segments; // 段，从旧到新
+        uint64_t _next_id;                   // 下一个段编号（只在打开和整理时使用）
+        size_t _memtable_limit;              // 日志记录数达到该值时写段
+        size_t _max_segments;                // 段数超过该值时归并
+        std::mutex _mutex;                   // 保护内存表和段列表，不在持有时做磁盘IO（日志追加除外）
+        std::mutex _checkpoint_mutex;        // 同一时刻只有一个整理
+    };
+}
+
+// BloomFilter
+uint64_t Cloud::BloomFilter::hash(std::string_view key)
+{
+    return Snapshot::checksum(key.data(), key.size());
+}
+
+std::string Cloud::BloomFilter::build(const std::vector<uint64_t> &hashes)
+{
+    size_t nbits = hashes.size() * bits_per_key;
+    if (nbits < 64)
+        nbits = 64;
+    std::string bits((nbits + 7) / 8, '\0');
+    nbits = bits.size() * 8;
+
+    for (uint64_t h : hashes)
+    {
+        uint64_t delta = (h >> 17) | (h << 47);
+        for (size_t j = 0; j < hash_num; j++)
+        {
+            size_t pos = h % nbits;
+            bits[pos / 8] |= (1 << (pos % 8));
+            h += delta;
+        }
+    }
+    return bits;
+}
+
+bool Cloud::BloomFilter::mayContain(const char *bits, size_t len, uint64_t h)
+{
+    size_t nbits = len * 8;
+    if (nbits == 0)
+        return true;
+
+    uint64_t delta = (h >> 17) | (h << 47);
+    for (size_t j = 0; j < hash_num; j++)
+    {
+        size_t pos = h % nbits;
+        if ((bits[pos / 8] & (1 << (pos % 8))) == 0)
+            return false;
+        h += delta;
+    }
+    return true;
+}
+
+// Segment
+Cloud::Segment::Segment(const std::string &path, uint64_t id)
+    : _path(path), _id(id), _map(nullptr), _map_len(0), _footer(nullptr)
+{
+}
+
+Cloud::Segment::~Segment()
+{
+    if (_map)
+        munmap((void *)_map, _map_len);
+}
+
+bool Cloud::Segment::open()
+{
+    int fd = ::open(_path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        DF_ERROR("%s: Segment open failed", _path.c_str());
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(Footer))
+    {
+        DF_ERROR("%s: Segment too short", _path.c_str());
+        ::close(fd);
+        return false;
+    }
+
+    void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+    {
+        DF_ERROR("%s: Segment mmap failed", _path.c_str());
+        return false;
+    }
+    _map = (const char *)p;
+    _map_len = st.st_size;
+
+    // 校验Footer、各区域边界与校验和
+    size_t body = _map_len - sizeof(Footer);
+    _footer = (const Footer *)(_map + body);
+    if (memcmp(_footer->magic, "CLDSEG01", sizeof(_footer->magic)) != 0 ||
+        _footer->index_off + _footer->index_count * sizeof(uint64_t) != _footer->bloom_off ||
+        _footer->bloom_off + _footer->bloom_size != body)
+    {
+        DF_ERROR("%s: Segment footer invalid", _path.c_str());
+        return false;
+    }
+    if (Snapshot::checksum(_map, body) != _footer->checksum)
+    {
+        DF_ERROR("%s: Segment checksum mismatch", _path.c_str());
+        return false;
+    }
+    return true;
+}
+
+uint64_t Cloud::Segment::id() const
+{
+    return _id;
+}
+
+const std::string &Cloud::Segment::path() const
+{
+    return _path;
+}
+
+size_t Cloud::Segment::size() const
+{
+    return _footer->count;
+}
+
+void Cloud::Segment::parse(size_t off, Cursor *cur) const
+{
+    EntryHead head;
+    memcpy(&head, _map + off, sizeof(head));
+    cur->off = off;
+    cur->key = std::string_view(_map + off + sizeof(head), head.key_len);
+    cur->flags = head.flags;
+    cur->next = off + sizeof(head) + head.key_len;
+    if (head.flags & FLAG_DELETED)
+    {
+        cur->value = nullptr;
+    }
+    else
+    {
+        cur->value = _map + cur->next;
+        cur->next += sizeof(Value);
+    }
+}
+
+bool Cloud::Segment::first(Cursor *cur) const
+{
+    if (_footer->index_off == 0)
+        return false;
+    parse(0, cur);
+    return true;
+}
+
+bool Cloud::Segment::next(Cursor *cur) const
+{
+    if (cur->next >= _footer->index_off)
+        return false;
+    parse(cur->next, cur);
+    return true;
+}
+
+bool Cloud::Segment::seek(std::string_view key, Cursor *cur) const
+{
+    if (_footer->index_count == 0)
+        return false;
+
+    // 二分稀疏索引：找到最后一个key <= 参数的索引项，从那里开始顺序扫描
+    const char *index = _map + _footer->index_off;
+    size_t lo = 0, hi = _footer->index_count;
+    while (hi - lo > 1)
+    {
+        size_t mid = (lo + hi) / 2;
+        uint64_t off;
+        memcpy(&off, index + mid * sizeof(uint64_t), sizeof(off));
+        parse(off, cur);
+        if (cur->key <= key)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    uint64_t off;
+    memcpy(&off, index + lo * sizeof(uint64_t), sizeof(off));
+    parse(off, cur);
+    while (cur->key < key)
+    {
+        if (!next(cur))
+            return false;
+    }
+    return true;
+}
+
+bool Cloud::Segment::get(std::string_view key, uint64_t h, Cursor *cur) const
+{
+    if (!BloomFilter::mayContain(_map + _footer->bloom_off, _footer->bloom_size, h))
+        return false;
+    return seek(key, cur) && cur->key == key;
+}
+
+void Cloud::Segment::decode(const Cursor &cur, BackupInfo *bi)
+{
+    Value v;
+    memcpy(&v, cur.value, sizeof(v));
+    bi->fsize = v.fsize;
+    bi->atime = v.atime;
+    bi->mtime = v.mtime;
+    bi->userID = v.userID;
+    bi->codec = v.codec;
+    bi->pack_flag = cur.flags & FLAG_PACKED;
+    bi->is_packing = false;
+    bi->rel_path.assign(cur.key.data(), cur.key.size());
+}
+
+// SegmentWriter
+Cloud::SegmentWriter::SegmentWriter()
+    : _count(0)
+{
+}
+
+void Cloud::SegmentWriter::add(std::string_view key, const BackupInfo *bi)
+{
+    if (_count % Segment::index_interval == 0)
+        _index.push_back(_data.size());
+    _hashes.push_back(BloomFilter::hash(key));
+    _count++;
+
+    Segment::EntryHead head;
+    memset(&head, 0, sizeof(head));
+    head.key_len = key.size();
+    if (!bi)
+        head.flags = Segment::FLAG_DELETED;
+    else if (bi->pack_flag)
+        head.flags = Segment::FLAG_PACKED;
+    _data.append((const char *)&head, sizeof(head));
+    _data.append(key.data(), key.size());
+    if (!bi)
+        return;
+
+    Segment::Value v;
+    memset(&v, 0, sizeof(v));
+    v.fsize = bi->fsize;
+    v.atime = bi->atime;
+    v.mtime = bi->mtime;
+    v.userID = bi->userID;
+    v.codec = bi->codec;
+    _data.append((const char *)&v, sizeof(v));
+}
+
+size_t Cloud::SegmentWriter::size() const
+{
+    return _count;
+}
+
+bool Cloud::SegmentWriter::commit(const std::string &path)
+{
+    Segment::Footer f;
+    memset(&f, 0, sizeof(f));
+    f.count = _count;
+    f.index_off = _data.size();
+    f.index_count = _index.size();
+    _data.append((const char *)_index.data(), _index.size() * sizeof(uint64_t));
+
+    std::string bloom = BloomFilter::build(_hashes);
+    f.bloom_off = _data.size();
+    f.bloom_size = bloom.size();
+    _data.append(bloom);
+
+    f.checksum = Snapshot::checksum(_data.data(), _data.size());
+    memcpy(f.magic, "CLDSEG01", sizeof(f.magic));
+    _data.append((const char *)&f, sizeof(f));
+
+    Util::FileUtil fu(path);
+    if (!fu.atomicSetContent(_data))
+    {
+        DF_ERROR("%s: Segment write failed", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+// LsmStore
+Cloud::LsmStore::LsmStore(const std::string &dir)
+    : _dir(dir), _wal(dir + "wal.log"), _next_id(1),
+      _memtable_limit(Cloud::Config::getInstance()->getCompactThreshold()),
+      _max_segments(Cloud::Config::getInstance()->getMaxSegments())
+{
+}
+
+std::string Cloud::LsmStore::segmentPath(uint64_t id)
+{
+    return _dir + "seg-" + std::to_string(id) + ".sst";
+}
+
+bool Cloud::LsmStore::open(const Loader &cb)
+{
+    // 打开期间没有其它线程访问，只在交回数据时加锁
+    // 1.打开MANIFEST中记录的全部段
+    Util::FileUtil dir(_dir);
+    if (!dir.createDirectory())
+    {
+        DF_ERROR("%s: Create meta dir failed", _dir.c_str());
+        return false;
+    }
+    bool fresh = !Util::FileUtil(_dir + "MANIFEST").isExists();
+    if (!fresh && !loadManifest())
+        return false;
+
+    // 2.回放日志，重建内存表
+    bool ok = _wal.replay([this](const Json::Value &record)
+    {
+        const std::string op = record["op"].asString();
+        if (op == "put")
+        {
+            auto bi = std::make_shared<BackupInfo>();
+            bi->fromJson(record["info"]);
+            _memtable[bi->rel_path] = bi;
+        }
+        else if (op == "del")
+        {
+            _memtable[record["path"].asString()] = nullptr;
+        }
+    });
+    if (!ok || !_wal.open())
+        return false;
+
+    // 3.首次启用lsm后端：导入旧的快照/Json备份
+    if (fresh)
+    {
+        if (_memtable.empty() && !importLegacy())
+            return false;
+        if (!saveManifest(_segments))
+            return false;
+    }
+
+    // 4.归并全部数据交给调用者；查询直接走本后端时不需要
+    if (!cb)
+    {
+        _logger->_debug("lsm元信息打开完成, 段 %d 个, 日志记录 %d 条", _segments.size(), _wal.records());
+        return true;
+    }
+    std::unique_lock<std::mutex> lck(_mutex);
+    size_t count = 0;
+    mergeLocked("", [&](std::string_view, const BackupInfo *bi)
+    {
+        if (bi)
+        {
+            cb(bi->rel_path, bi);
+            count++;
+        }
+        return true;
+    });
+
+    _logger->_debug("lsm元信息加载完成, 段 %d 个, 日志记录 %d 条, 文件 %d 个", _segments.size(), _wal.records(), count);
+    return true;
+}
+
+bool Cloud::LsmStore::importLegacy()
+{
+    Cloud::Config *conf = Cloud::Config::getInstance();
+    std::string snapshotFile = conf->getSnapshotFile();
+    std::string managerFile = conf->getManagerFile();
+    if (!Util::FileUtil(snapshotFile).isExists() && !Util::FileUtil(managerFile).isExists())
+        return true;
+
+    JournalStore legacy(snapshotFile, conf->getJournalFile(), managerFile);
+    bool ok = legacy.open([this](const std::string &rel, const BackupInfo *bi)
+    {
+        if (bi)
+            _memtable[rel] = std::make_shared<const BackupInfo>(*bi);
+        else
+            _memtable.erase(rel); // 还没有任何段，删除无需墓碑
+    });
+    if (!ok)
+        return false;
+
+    _logger->_info("旧的备份信息已导入lsm存储, 文件 %d 个", _memtable.size());
+    _immutable.swap(_memtable);
+    return flushImmutable(_wal.mark());
+}
+
+bool Cloud::LsmStore::write(const std::vector<MetaChange> &changes, bool durable)
+{
+    std::vector<Json::Value> records;
+    records.reserve(changes.size());
+    for (const MetaChange &c : changes)
+    {
+        Json::Value record;
+        if (c.info)
+        {
+            record["op"] = "put";
+            record["info"] = c.info->toJson();
+        }
+        else
+        {
+            record["op"] = "del";
+            record["path"] = c.rel;
+        }
+        records.push_back(std::move(record));
+    }
+
+    // 先写日志，再修改内存表；durable为false时不等待落盘，由调用者稍后sync
+    std::unique_lock<std::mutex> lck(_mutex);
+    if (!_wal.append(records, durable))
+        return false;
+    for (const MetaChange &c : changes)
+    {
+        // is_packing是运行时状态，不持久化：内存表中保存与日志和段中一致的记录
+        BackupInfo::Ptr info = c.info;
+        if (info && info->is_packing)
+        {
+            BackupInfo copy = *info;
+            copy.is_packing = false;
+            info = std::make_shared<const BackupInfo>(copy);
+        }
+        _memtable[c.rel] = info;
+    }
+    return true;
+}
+
+bool Cloud::LsmStore::sync()
+{
+    return _wal.sync();
+}
+
+bool Cloud::LsmStore::indexed()
+{
+    return true;
+}
+
+Cloud::BackupInfo::Ptr Cloud::LsmStore::get(std::string_view rel)
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+
+    for (const Memtable *t : {&_memtable, &_immutable})
+    {
+        auto it = t->find(rel);
+        if (it != t->end())
+            return it->second; // 墓碑为nullptr
+    }
+
+    uint64_t h = BloomFilter::hash(rel);
+    Segment::Cursor cur;
+    for (size_t i = _segments.size(); i > 0; i--)
+    {
+        if (!_segments[i - 1]->get(rel, h, &cur))
+            continue;
+        if (cur.flags & Segment::FLAG_DELETED)
+            return nullptr;
+        auto bi = std::make_shared<BackupInfo>();
+        Segment::decode(cur, bi.get());
+        return bi;
+    }
+    return nullptr;
+}
+
+void Cloud::LsmStore::scan(const std::string &prefix, const std::string &after, size_t limit,
+                           std::vector<BackupInfo::Ptr> *out)
+{
+    std::string_view from = after.empty() || after < prefix ? std::string_view(prefix) : std::string_view(after);
+    size_t n = 0;
+
+    std::unique_lock<std::mutex> lck(_mutex);
+    mergeLocked(from, [&](std::string_view key, const BackupInfo *bi)
+    {
+        if (key.compare(0, prefix.size(), prefix) != 0)
+            return false;
+        if (!bi || (!after.empty() && key == after))
+            return true;
+        out->push_back(std::make_shared<const BackupInfo>(*bi));
+        return limit == 0 || ++n < limit;
+    });
+}
+
+bool Cloud::LsmStore::needCheckpoint()
+{
+    return _wal.records() >= _memtable_limit;
+}
+
+bool Cloud::LsmStore::checkpoint(const Dumper &)
+{
+    std::unique_lock<std::mutex> ck(_checkpoint_mutex);
+
+    // 1.锁内只交换内存表、记下日志位置，此后的写入进入新的内存表和日志的后半段
+    Journal::Mark upto;
+    {
+        std::unique_lock<std::mutex> lck(_mutex);
+        _immutable.swap(_memtable);
+        upto = _wal.mark();
+    }
+
+    // 2.锁外写段、归并
+    if (!flushImmutable(upto))
+        return false;
+    size_t segments;
+    {
+        std::unique_lock<std::mutex> lck(_mutex);
+        segments = _segments.size();
+    }
+    if (segments > _max_segments)
+        return mergeSegments();
+    return true;
+}
+
+void Cloud::LsmStore::merge(const std::vector<const Memtable *> &tables, const std::vector<Segment::Ptr> &segments,
+                            std::string_view from, const Merger &cb)
+{
+    // 每个段一个游标，每个内存表一个迭代器；每轮取出最小的key，内存表最新（靠前的更新），其次是编号大的段
+    size_t n = segments.size();
+    std::vector<Segment::Cursor> curs(n);
+    std::vector<bool> valid(n);
+    for (size_t i = 0; i < n; i++)
+        valid[i] = from.empty() ? segments[i]->first(&curs[i]) : segments[i]->seek(from, &curs[i]);
+    std::vector<Memtable::const_iterator> mits;
+    for (const Memtable *t : tables)
+        mits.push_back(t->lower_bound(from));
+
+    BackupInfo bi;
+    while (true)
+    {
+        bool has = false;
+        std::string_view minKey;
+        for (size_t i = 0; i < n; i++)
+        {
+            if (valid[i] && (!has || curs[i].key < minKey))
+            {
+                minKey = curs[i].key;
+                has = true;
+            }
+        }
+        for (size_t t = 0; t < tables.size(); t++)
+        {
+            if (mits[t] != tables[t]->end() && (!has || mits[t]->first < minKey))
+            {
+                minKey = mits[t]->first;
+                has = true;
+            }
+        }
+        if (!has)
+            break;
+
+        // 取最新版本
+        const BackupInfo *found = nullptr;
+        bool decided = false;
+        for (size_t t = 0; t < tables.size() && !decided; t++)
+        {
+            if (mits[t] != tables[t]->end() && mits[t]->first == minKey)
+            {
+                found = mits[t]->second.get();
+                decided = true;
+            }
+        }
+        for (size_t i = n; i > 0 && !decided; i--)
+        {
+            if (valid[i - 1] && curs[i - 1].key == minKey)
+            {
+                if (!(curs[i - 1].flags & Segment::FLAG_DELETED))
+                {
+                    Segment::decode(curs[i - 1], &bi);
+                    found = &bi;
+                }
+                decided = true;
+            }
+        }
+        if (!cb(minKey, found))
+            break;
+
+        // 所有指向该key的游标前进一步（minKey指向mmap或内存表中的key，前进不会使其失效）
+        for (size_t i = 0; i < n; i++)
+        {
+            if (valid[i] && curs[i].key == minKey)
+                valid[i] = segments[i]->next(&curs[i]);
+        }
+        for (size_t t = 0; t < tables.size(); t++)
+        {
+            if (mits[t] != tables[t]->end() && mits[t]->first == minKey)
+                ++mits[t];
+        }
+    }
+}
+
+void Cloud::LsmStore::mergeLocked(std::string_view from, const Merger &cb)
+{
+    merge({&_memtable, &_immutable}, _segments, from, cb);
+}
+
+void Cloud::LsmStore::thawLocked()
+{
+    // 内存表中的记录更新，覆盖只读内存表中的同一key
+    for (auto &[k, v] : _memtable)
+        _immutable[k] = v;
+    _memtable.swap(_immutable);
+    _immutable.clear();
+}
+
+bool Cloud::LsmStore::flushImmutable(const Journal::Mark &upto)
+{
+    // 1.只读内存表已按key有序，直接写成新段（墓碑保留，用于遮盖旧段中的记录）
+    //   只读内存表只在整理期间改变，锁外读取与锁内的读者并不冲突
+    Segment::Ptr seg;
+    size_t count = _immutable.size();
+    if (count > 0)
+    {
+        SegmentWriter writer;
+        for (auto &[k, v] : _immutable)
+            writer.add(k, v.get());
+
+        uint64_t id = _next_id++;
+        std::string path = segmentPath(id);
+        seg = std::make_shared<Segment>(path, id);
+        if (!writer.commit(path) || !seg->open())
+        {
+            std::unique_lock<std::mutex> lck(_mutex);
+            thawLocked();
+            return false;
+        }
+
+        // 2.新段写入MANIFEST之后才对读者可见，同时撤下只读内存表
+        std::vector<Segment::Ptr> segments;
+        {
+            std::unique_lock<std::mutex> lck(_mutex);
+            segments = _segments;
+        }
+        segments.push_back(seg);
+        bool saved = saveManifest(segments);
+        std::unique_lock<std::mutex> lck(_mutex);
+        if (!saved)
+        {
+            thawLocked();
+            Util::FileUtil(path).remove();
+            return false;
+        }
+        _segments.swap(segments);
+        _immutable.clear();
+    }
+
+    // 3.日志中upto之前的记录已经在段中，可以丢弃（之后追加的保留）
+    if (!_wal.reset(upto))
+        return false;
+    if (seg)
+        _logger->_debug("lsm内存表写入段 %s, 记录 %d 条", seg->path().c_str(), count);
+    return true;
+}
+
+bool Cloud::LsmStore::mergeSegments()
+{
+    // 1.归并当前全部段，结果是最底层，墓碑可以丢弃；段文件只读，锁外读取
+    //   只有整理会增加段，归并期间段列表不变
+    std::vector<Segment::Ptr> old;
+    {
+        std::unique_lock<std::mutex> lck(_mutex);
+        old = _segments;
+    }
+    SegmentWriter writer;
+    merge({}, old, "", [&writer](std::string_view key, const BackupInfo *bi)
+    {
+        if (bi)
+            writer.add(key, bi);
+        return true;
+    });
+
+    uint64_t id = _next_id++;
+    std::string path = segmentPath(id);
+    auto seg = std::make_shared<Segment>(path, id);
+    if (!writer.commit(path) || !seg->open())
+        return false;
+
+    // 2.MANIFEST换成新段之后再替换段列表，正在读旧段的读者持有其shared_ptr，不受影响
+    if (!saveManifest({seg}))
+    {
+        Util::FileUtil(path).remove();
+        return false;
+    }
+    {
+        std::unique_lock<std::mutex> lck(_mutex);
+        _segments = {seg};
+    }
+
+    // MANIFEST已不再引用旧段，可以删除
+    for (auto &s : old)
+        Util::FileUtil(s->path()).remove();
+
+    _logger->_debug("lsm归并 %d 个段为 %s, 记录 %d 条", old.size(), path.c_str(), writer.size());
+    return true;
+}
+
+bool Cloud::LsmStore::loadManifest()
+{
+    std::string content;
+    Json::Value root;
+    Util::FileUtil fu(_dir + "MANIFEST");
+    if (!fu.getContent(content) || !Util::JsonUtil::unserialize(content, &root))
+    {
+        DF_ERROR("%sMANIFEST: read failed", _dir.c_str());
+        return false;
+    }
+
+    _next_id = root["next_id"].asUInt64();
+    for (auto &item : root["segments"])
+    {
+        uint64_t id = item.asUInt64();
+        auto seg = std::make_shared<Segment>(segmentPath(id), id);
+        if (!seg->open())
+            return false;
+        _segments.push_back(seg);
+    }
+    return true;
+}
+
+bool Cloud::LsmStore::saveManifest(const std::vector<Segment::Ptr> &segments)
+{
+    Json::Value root;
+    root["next_id"] = static_cast<Json::UInt64>(_next_id);
+    root["segments"] = Json::Value(Json::arrayValue);
+    for (auto &seg : segments)
+        root["segments"].append(static_cast<Json::UInt64>(seg->id()));
+
+    std::string content;
+    Util::JsonUtil::serialize(root, &content);
+    Util::FileUtil fu(_dir + "MANIFEST");
+    if (!fu.atomicSetContent(content))
+    {
+        DF_ERROR("%sMANIFEST: write failed", _dir.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,253 @@
+#pragma once
+#include <map>
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <sstream>
+#include <functional>
+#include "util.hh"
+
+namespace Cloud
+{
+    // 计数器：只增不减
+    class Counter
+    {
+    public:
+        Counter() : _value(0) {}
+        void inc(uint64_t n = 1) { _value.fetch_add(n, std::memory_order_relaxed); }
+        uint64_t value() const { return _value.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<uint64_t> _value;
+    };
+
+    // 直方图：固定的桶上界，落在(上一个上界, 上界]的观测计入该桶，另记总和与个数
+    class Histogram
+    {
+    public:
+        Histogram(const std::vector<double> &bounds);
+
+        void observe(double v);
+        void snapshot(std::vector<uint64_t> *cumulative, double *sum, uint64_t *count) const; // 累计计数（与Prometheus的le语义一致）
+        const std::vector<double> &bounds() const { return _bounds; }
+
+    private:
+        std::vector<double> _bounds;
+        std::unique_ptr<std::atomic<uint64_t>[]> _buckets; // 最后一个是+Inf
+        std::atomic<double> _sum;
+        std::atomic<uint64_t> _count;
+    };
+
+    // 指标注册表：按名字+标签取得（不存在则创建）计数器、直方图，注册按需求值的仪表
+    // 返回的引用在进程内一直有效，热路径上应保存引用，避免每次查表加锁
+    // render输出Prometheus文本格式，由/metrics接口返回
+    class Metrics
+    {
+    public:
+        static Metrics &getInstance(); // 获取单例对象
+
+        // labels为Prometheus标签列表，如 codec="LZ4",result="ok"；可用label()拼接
+        Counter &counter(const std::string &name, const std::string &help, const std::string &labels = "");
+        Histogram &histogram(const std::string &name, const std::string &help, const std::vector<double> &bounds,
+                             const std::string &labels = "");
+        void gauge(const std::string &name, const std::string &help, std::function<double()> value,
+                   const std::string &labels = ""); // 仪表在导出时求值，重复注册时替换
+        std::string render();
+
+        static std::string label(const std::string &key, const std::string &value); // key="value"（转义引号、反斜杠和换行）
+
+    private:
+        Metrics() = default;
+        Metrics(const Metrics &other) = delete;
+        Metrics &operator=(const Metrics &other) = delete;
+
+        struct Family // 同名的一组指标
+        {
+            std::string type; // counter/gauge/histogram
+            std::string help;
+            std::map<std::string, std::unique_ptr<Counter>> counters;     // 标签 -> 计数器
+            std::map<std::string, std::unique_ptr<Histogram>> histograms; // 标签 -> 直方图
+            std::map<std::string, std::function<double()>> gauges;        // 标签 -> 求值函数
+        };
+
+        Family &familyLocked(const std::string &name, const std::string &type, const std::string &help);
+        static std::string series(const std::string &name, const std::string &labels, const std::string &extra = "");
+        static std::string number(double v); // 整数原样输出，小数用能精确还原的最短写法
+
+    private:
+        std::map<std::string, Family> _families; // 按名字有序，输出稳定
+        std::mutex _mutex;
+    };
+}
+
+// Histogram
+Cloud::Histogram::Histogram(const std::vector<double> &bounds)
+    : _bounds(bounds), _buckets(new std::atomic<uint64_t>[bounds.size() + 1]), _sum(0), _count(0)
+{
+    std::sort(_bounds.begin(), _bounds.end());
+    for (size_t i = 0; i <= _bounds.size(); i++)
+        _buckets[i] = 0;
+}
+
+void Cloud::Histogram::observe(double v)
+{
+    size_t i = std::lower_bound(_bounds.begin(), _bounds.end(), v) - _bounds.begin();
+    _buckets[i].fetch_add(1, std::memory_order_relaxed);
+    double sum = _sum.load(std::memory_order_relaxed);
+    while (!_sum.compare_exchange_weak(sum, sum + v, std::memory_order_relaxed))
+        ;
+    _count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Cloud::Histogram::snapshot(std::vector<uint64_t> *cumulative, double *sum, uint64_t *count) const
+{
+    // 各项分别读取，导出期间的并发观测可能使_count与桶之和相差几个，对监控无影响
+    cumulative->clear();
+    uint64_t acc = 0;
+    for (size_t i = 0; i <= _bounds.size(); i++)
+    {
+        acc += _buckets[i].load(std::memory_order_relaxed);
+        cumulative->push_back(acc);
+    }
+    *sum = _sum.load(std::memory_order_relaxed);
+    *count = acc;
+}
+
+// Metrics
+Cloud::Metrics &Cloud::Metrics::getInstance()
+{
+    static Metrics inst;
+    return inst;
+}
+
+Cloud::Counter &Cloud::Metrics::counter(const std::string &name, const std::string &help, const std::string &labels)
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    std::unique_ptr<Counter> &c = familyLocked(name, "counter", help).counters[labels];
+    if (!c)
+        c.reset(new Counter());
+    return *c;
+}
+
+Cloud::Histogram &Cloud::Metrics::histogram(const std::string &name, const std::string &help,
+                                            const std::vector<double> &bounds, const std::string &labels)
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    std::unique_ptr<Histogram> &h = familyLocked(name, "histogram", help).histograms[labels];
+    if (!h)
+        h.reset(new Histogram(bounds));
+    return *h;
+}
+
+void Cloud::Metrics::gauge(const std::string &name, const std::string &help, std::function<double()> value,
+                           const std::string &labels)
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    familyLocked(name, "gauge", help).gauges[labels] = std::move(value);
+}
+
+std::string Cloud::Metrics::render()
+{
+    // 仪表的求值函数可能要取其它模块的锁，在锁外求值
+    std::vector<std::pair<std::string, std::function<double()>>> gauges;
+    std::ostringstream oss;
+    {
+        std::unique_lock<std::mutex> lck(_mutex);
+        for (auto &[name, f] : _families)
+        {
+            if (f.type == "gauge")
+            {
+                gauges.push_back({"# HELP " + name + " " + f.help + "\n# TYPE " + name + " gauge\n", nullptr});
+                for (auto &[labels, fn] : f.gauges)
+                    gauges.push_back({series(name, labels), fn});
+                continue;
+            }
+
+            oss << "# HELP " << name << " " << f.help << "\n# TYPE " << name << " " << f.type << "\n";
+            for (auto &[labels, c] : f.counters)
+                oss << series(name, labels) << " " << c->value() << "\n";
+            for (auto &[labels, h] : f.histograms)
+            {
+                std::vector<uint64_t> cumulative;
+                double sum;
+                uint64_t count;
+                h->snapshot(&cumulative, &sum, &count);
+                for (size_t i = 0; i < cumulative.size(); i++)
+                {
+                    std::string le = i < h->bounds().size() ? number(h->bounds()[i]) : "+Inf";
+                    oss << series(name + "_bucket", labels, label("le", le)) << " " << cumulative[i] << "\n";
+                }
+                oss << series(name + "_sum", labels) << " " << number(sum) << "\n";
+                oss << series(name + "_count", labels) << " " << count << "\n";
+            }
+        }
+    }
+
+    for (auto &[line, fn] : gauges)
+    {
+        if (fn)
+            oss << line << " " << number(fn()) << "\n";
+        else
+            oss << line;
+    }
+    return oss.str();
+}
+
+std::string Cloud::Metrics::label(const std::string &key, const std::string &value)
+{
+    std::string s = key + "=\"";
+    for (char c : value)
+    {
+        if (c == '\\' || c == '"')
+            s.push_back('\\');
+        if (c == '\n')
+        {
+            s += "\\n";
+            continue;
+        }
+        s.push_back(c);
+    }
+    return s + "\"";
+}
+
+Cloud::Metrics::Family &Cloud::Metrics::familyLocked(const std::string &name, const std::string &type, const std::string &help)
+{
+    Family &f = _families[name];
+    if (f.type.empty())
+    {
+        f.type = type;
+        f.help = help;
+    }
+    else if (f.type != type)
+        DF_WARN("metric %s registered as both %s and %s", name.c_str(), f.type.c_str(), type.c_str());
+    return f;
+}
+
+std::string Cloud::Metrics::series(const std::string &name, const std::string &labels, const std::string &extra)
+{
+    std::string all = labels.empty() ? extra : (extra.empty() ? labels : labels + "," + extra);
+    return all.empty() ? name : name + "{" + all + "}";
+}
+
+std::string Cloud::Metrics::number(double v)
+{
+    if (std::isnan(v))
+        return "NaN";
+    if (std::isinf(v))
+        return v > 0 ? "+Inf" : "-Inf";
+
+    // 默认的6位有效数字会把67108864输出成6.71089e+07
+    char buf[32];
+    if (v == std::floor(v) && std::fabs(v) < 1e15)
+    {
+        snprintf(buf, sizeof(buf), "%.0f", v);
+        return buf;
+    }
+    snprintf(buf, sizeof(buf), "%.15g", v);
+    if (strtod(buf, nullptr) != v)
+        snprintf(buf, sizeof(buf), "%.17g", v);
+    return buf;
+}
@@ -0,0 +1,443 @@
+#pragma once
+#include <cstring>
+#include "util.hh"
+
+namespace Cloud
+{
+    // 分块压缩包
+    // 文件布局：| Header | 块数据 * n | Block * n（块索引）| Footer |
+    // 文件按chunk_size切成块，每块独立压缩，可以由多个线程并行压缩，按块号顺序写出；
+    // 结尾的块索引记录每块的位置、长度和校验和，读取任意区间时只需解压与之重叠的块
+    // 头部记录压缩算法，块数据是该算法的bundle压缩数据
+    // 没有"CLDPACK1"头部的压缩包是旧格式：整个文件一个bundle压缩数据，视为只有一块
+    class Pack
+    {
+    public:
+        struct Header
+        {
+            char magic[8];       // "CLDPACK1"
+            uint32_t version;    // 格式版本
+            uint32_t chunk_size; // 块大小（解压后），最后一块可能更小
+            uint64_t fsize;      // 原文件大小
+            uint32_t codec;      // 压缩算法（bundle编号）
+            uint32_t src_mtime_ns; // 压缩时原文件修改时间的纳秒部分（秒在备份信息中），用于区分压缩之后的重新上传
+        };
+
+        struct Block // 块索引项
+        {
+            uint64_t offset;   // 块数据在压缩包中的偏移
+            uint32_t z_len;    // 块数据长度
+            uint32_t raw_len;  // 解压后的长度
+            uint64_t checksum; // 块数据的FNV-1a校验和
+            uint32_t flags;    // FLAG_STORED
+            uint32_t reserved;
+        };
+
+        struct Footer
+        {
+            uint64_t index_offset; // 块索引的偏移
+            uint64_t count;        // 块数
+            uint64_t checksum;     // 块索引的FNV-1a校验和
+            char magic[8];         // "CLDPKEND"
+        };
+
+        enum
+        {
+            FLAG_STORED = 0x1, // 压缩后没有变小，原样保存
+            FLAG_LEGACY = 0x2  // 旧格式的整个文件（没有校验和）
+        };
+
+        static const uint32_t version = 1;
+
+        static std::string compressBlock(const std::string &raw, unsigned codec, Block *block); // 压缩一块，填写长度、标志和校验和
+    };
+
+    // 顺序写出压缩包：块必须按块号顺序追加，finish时写出块索引
+    // 先写到"压缩包路径.tmp"，finish时fsync后rename到正式路径并同步目录，
+    // 崩溃时pack_dir中只会有完整的压缩包或残留的.tmp（启动时清理）
+    class PackWriter
+    {
+    public:
+        PackWriter(const std::string &path);
+        ~PackWriter();
+
+        static constexpr const char *tmp_suffix = ".tmp"; // 未完成的压缩包的后缀
+
+        bool open(uint32_t chunkSize, uint64_t fsize, unsigned codec, uint32_t srcMtimeNs); // 创建临时文件并写出头部
+        bool append(const Pack::Block &block, const std::string &data); // 追加一块（block.offset由写出位置决定）
+        bool finish();                                                // 写出块索引，落盘后原子地改名为正式路径
+        void abort();                                                 // 关闭并删除临时文件
+        uint64_t size() const;                                        // 已写出的字节数（finish之后为压缩包大小）
+
+    private:
+        bool writeAll(const char *data, size_t len);
+
+    private:
+        std::string _path;
+        std::string _tmp_path;
+        int _fd;
+        uint64_t _offset;                 // 当前写出位置
+        std::vector<Pack::Block> _index; // 已写出的块
+    };
+
+    // 按块读取压缩包：打开时只读头部和块索引，块数据按需读取、解压
+    // 打开后只读，可以被多个线程同时使用
+    class PackReader
+    {
+    public:
+        PackReader(const std::string &path);
+        ~PackReader();
+
+        bool open();                                    // 读取头部与块索引并校验
+        const std::string &path() const;
+        time_t mtime() const;                           // 压缩包的修改时间（与packSize一起判断是否被重新生成）
+        uint64_t packSize() const;                      // 压缩包大小
+        uint64_t size() const;                          // 原文件大小
+        unsigned codec() const;                         // 压缩算法
+        uint32_t srcMtimeNs() const;                    // 压缩时原文件修改时间的纳秒部分（旧格式为0）
+        size_t blocks() const;                          // 块数
+        size_t blockOf(uint64_t offset) const;          // 原文件偏移所在的块
+        uint64_t blockOffset(size_t i) const;           // 第i块在原文件中的起始偏移
+        bool readBlock(size_t i, std::string *raw) const; // 读取并解压第i块
+        bool readAll(std::string *content) const;       // 整体解压
+
+    private:
+        bool preadAll(char *buf, size_t len, uint64_t offset) const;
+
+    private:
+        std::string _path;
+        int _fd;
+        time_t _mtime;
+        uint64_t _pack_size;
+        uint64_t _fsize;
+        uint64_t _chunk_size;
+        unsigned _codec;
+        uint32_t _src_mtime_ns;
+        std::vector<Pack::Block> _index;
+    };
+}
+
+std::string Cloud::Pack::compressBlock(const std::string &raw, unsigned codec, Block *block)
+{
+    memset(block, 0, sizeof(*block));
+    block->raw_len = raw.size();
+
+    std::string packed;
+    if (raw.empty() || !bundle::pack(codec, packed, raw) || packed.size() >= raw.size())
+    {
+        packed = raw;
+        block->flags = FLAG_STORED;
+    }
+    block->z_len = packed.size();
+    block->checksum = Snapshot::checksum(packed.data(), packed.size());
+    return packed;
+}
+
+// PackWriter
+Cloud::PackWriter::PackWriter(const std::string &path)
+    : _path(path), _tmp_path(path + tmp_suffix), _fd(-1), _offset(0)
+{
+}
+
+Cloud::PackWriter::~PackWriter()
+{
+    if (_fd >= 0)
+        ::close(_fd);
+}
+
+bool Cloud::PackWriter::open(uint32_t chunkSize, uint64_t fsize, unsigned codec, uint32_t srcMtimeNs)
+{
+    _fd = ::open(_tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (_fd < 0)
+    {
+        DF_WARN("%s: Pack open failed", _tmp_path.c_str());
+        return false;
+    }
+
+    Pack::Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "CLDPACK1", sizeof(h.magic));
+    h.version = Pack::version;
+    h.chunk_size = chunkSize;
+    h.fsize = fsize;
+    h.codec = codec;
+    h.src_mtime_ns = srcMtimeNs;
+    return writeAll((const char *)&h, sizeof(h));
+}
+
+bool Cloud::PackWriter::append(const Pack::Block &block, const std::string &data)
+{
+    Pack::Block b = block;
+    b.offset = _offset;
+    if (!writeAll(data.data(), data.size()))
+        return false;
+    _index.push_back(b);
+    return true;
+}
+
+bool Cloud::PackWriter::finish()
+{
+    Pack::Footer f;
+    memset(&f, 0, sizeof(f));
+    f.index_offset = _offset;
+    f.count = _index.size();
+    f.checksum = Snapshot::checksum((const char *)_index.data(), _index.size() * sizeof(Pack::Block));
+    memcpy(f.magic, "CLDPKEND", sizeof(f.magic));
+    if (!writeAll((const char *)_index.data(), _index.size() * sizeof(Pack::Block)) ||
+        !writeAll((const char *)&f, sizeof(f)))
+        return false;
+
+    // 内容落盘后才改名：正式路径上的压缩包一定是完整的
+    if (::fsync(_fd) < 0)
+    {
+        DF_WARN("%s: Pack fsync failed", _tmp_path.c_str());
+        return false;
+    }
+    int fd = _fd;
+    _fd = -1;
+    if (::close(fd) < 0)
+    {
+        DF_WARN("%s: Pack close failed", _tmp_path.c_str());
+        return false;
+    }
+    if (::rename(_tmp_path.c_str(), _path.c_str()) < 0)
+    {
+        DF_WARN("%s: Pack rename failed", _path.c_str());
+        return false;
+    }
+
+    // rename本身也要落盘，之后才能修改元信息、删除原文件
+    Util::fs::path parent = Util::fs::path(_path).parent_path();
+    int dirfd = ::open(parent.empty() ? "." : parent.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dirfd >= 0)
+    {
+        ::fsync(dirfd);
+        ::close(dirfd);
+    }
+    return true;
+}
+
+void Cloud::PackWriter::abort()
+{
+    if (_fd >= 0)
+    {
+        ::close(_fd);
+        _fd = -1;
+    }
+    ::unlink(_tmp_path.c_str());
+}
+
+uint64_t Cloud::PackWriter::size() const
+{
+    return _offset;
+}
+
+bool Cloud::PackWriter::writeAll(const char *data, size_t len)
+{
+    size_t written = 0;
+    while (written < len)
+    {
+        ssize_t n = ::write(_fd, data + written, len - written);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            DF_WARN("%s: Pack write failed", _tmp_path.c_str());
+            return false;
+        }
+        written += n;
+    }
+    _offset += len;
+    return true;
+}
+
+// PackReader
+Cloud::PackReader::PackReader(const std::string &path)
+    : _path(path), _fd(-1), _mtime(0), _pack_size(0), _fsize(0), _chunk_size(0), _codec(bundle::LZIP), _src_mtime_ns(0)
+{
+}
+
+Cloud::PackReader::~PackReader()
+{
+    if (_fd >= 0)
+        ::close(_fd);
+}
+
+bool Cloud::PackReader::open()
+{
+    _fd = ::open(_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (_fd < 0)
+    {
+        DF_WARN("%s: Pack open failed", _path.c_str());
+        return false;
+    }
+    struct stat st;
+    if (fstat(_fd, &st) < 0)
+        return false;
+    uint64_t fileSize = st.st_size;
+    _mtime = st.st_mtime;
+    _pack_size = fileSize;
+
+    // 1.旧格式：整个文件作为一块，原文件大小从bundle头部取出
+    Pack::Header h;
+    memset(&h, 0, sizeof(h));
+    if (fileSize < sizeof(h) || !preadAll((char *)&h, sizeof(h), 0) ||
+        memcmp(h.magic, "CLDPACK1", 8) != 0)
+    {
+        char head[bundle::MAX_HEADER_SIZE] = {0};
+        size_t n = std::min<uint64_t>(fileSize, sizeof(head));
+        if (n > 0 && !preadAll(head, n, 0))
+            return false;
+
+        Pack::Block b;
+        memset(&b, 0, sizeof(b));
+        b.z_len = fileSize;
+        b.raw_len = n > 0 ? bundle::len(head, n) : 0;
+        b.flags = Pack::FLAG_LEGACY;
+        _fsize = _chunk_size = b.raw_len;
+        _index.push_back(b);
+        return true;
+    }
+
+    _fsize = h.fsize;
+    _chunk_size = h.chunk_size;
+    _codec = h.codec;
+    _src_mtime_ns = h.src_mtime_ns;
+    if (h.version != Pack::version || _chunk_size == 0)
+    {
+        DF_WARN("%s: Pack version %d not supported", _path.c_str(), (int)h.version);
+        return false;
+    }
+
+    // 2.从结尾读取块索引并校验
+    Pack::Footer f;
+    if (fileSize < sizeof(h) + sizeof(f) || !preadAll((char *)&f, sizeof(f), fileSize - sizeof(f)) ||
+        memcmp(f.magic, "CLDPKEND", 8) != 0 ||
+        f.index_offset + f.count * sizeof(Pack::Block) + sizeof(f) != fileSize)
+    {
+        DF_WARN("%s: Pack footer invalid", _path.c_str());
+        return false;
+    }
+    _index.resize(f.count);
+    if (!preadAll((char *)_index.data(), f.count * sizeof(Pack::Block), f.index_offset) ||
+        Snapshot::checksum((const char *)_index.data(), f.count * sizeof(Pack::Block)) != f.checksum)
+    {
+        DF_WARN("%s: Pack index checksum mismatch", _path.c_str());
+        return false;
+    }
+    if (_index.size() != std::max<uint64_t>(1, (_fsize + _chunk_size - 1) / _chunk_size))
+    {
+        DF_WARN("%s: Pack index size mismatch", _path.c_str());
+        return false;
+    }
+    return true;
+}
+
+const std::string &Cloud::PackReader::path() const
+{
+    return _path;
+}
+
+time_t Cloud::PackReader::mtime() const
+{
+    return _mtime;
+}
+
+uint64_t Cloud::PackReader::packSize() const
+{
+    return _pack_size;
+}
+
+uint64_t Cloud::PackReader::size() const
+{
+    return _fsize;
+}
+
+unsigned Cloud::PackReader::codec() const
+{
+    return _codec;
+}
+
+uint32_t Cloud::PackReader::srcMtimeNs() const
+{
+    return _src_mtime_ns;
+}
+
+size_t Cloud::PackReader::blocks() const
+{
+    return _index.size();
+}
+
+size_t Cloud::PackReader::blockOf(uint64_t offset) const
+{
+    if (_chunk_size == 0)
+        return 0;
+    return std::min<size_t>(offset / _chunk_size, _index.size() - 1);
+}
+
+uint64_t Cloud::PackReader::blockOffset(size_t i) const
+{
+    return i * _chunk_size;
+}
+
+bool Cloud::PackReader::readBlock(size_t i, std::string *raw) const
+{
+    const Pack::Block &b = _index[i];
+    std::string data(b.z_len, '\0');
+    if (!preadAll(&data[0], b.z_len, b.offset))
+        return false;
+    if (!(b.flags & Pack::FLAG_LEGACY) && Snapshot::checksum(data.data(), data.size()) != b.checksum)
+    {
+        DF_WARN("%s: Block %d checksum mismatch", _path.c_str(), (int)i);
+        return false;
+    }
+
+    if (b.flags & Pack::FLAG_STORED)
+        raw->swap(data);
+    else if (!data.empty() && (bundle::type_of(data) != _codec || !bundle::unpack(*raw, data)))
+    {
+        DF_WARN("%s: Uncompress block %d failed", _path.c_str(), (int)i);
+        return false;
+    }
+    else if (data.empty())
+        raw->clear();
+
+    if (raw->size() != b.raw_len)
+    {
+        DF_WARN("%s: Block %d size mismatch", _path.c_str(), (int)i);
+        return false;
+    }
+    return true;
+}
+
+bool Cloud::PackReader::readAll(std::string *content) const
+{
+    content->clear();
+    content->reserve(_fsize);
+    std::string raw;
+    for (size_t i = 0; i < _index.size(); i++)
+    {
+        if (!readBlock(i, &raw))
+            return false;
+        content->append(raw);
+    }
+    return content->size() == _fsize;
+}
+
+bool Cloud::PackReader::preadAll(char *buf, size_t len, uint64_t offset) const
+{
+    size_t got = 0;
+    while (got < len)
+    {
+        ssize_t n = ::pread(_fd, buf + got, len - got, offset + got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            DF_WARN("%s: Pack read failed", _path.c_str());
+            return false;
+        }
+        got += n;
+    }
+    return true;
+}
@@ -4,6 +4,9 @@
 #include "data.hh"
 #include "httplib.h"
 #include "user.hh"
+#include "threadpool.hh"
+#include "cache.hh"
+#include "metrics.hh"
 
 extern Cloud::BackupInfoManager *_biManager;
 extern ckflogs::Logger::Ptr _logger;
@@ -15,7 +18,8 @@ namespace Cloud
     {
     public:
         Service();
-        void run();
+        void run();  // 监听并处理请求，stop之后返回
+        void stop(); // 停止监听，等待正在处理的请求完成后run返回（可在其它线程调用）
 
     private:
         static void index(const httplib::Request &req, httplib::Response &resp);         // 登录索引界面
@@ -26,23 +30,30 @@ namespace Cloud
 
         static void upload(const httplib::Request &req, httplib::Response &resp);   // 文件上传
         static void download(const httplib::Request &req, httplib::Response &resp); // 文件下载
+        static void remove(const httplib::Request &req, httplib::Response &resp);   // 文件删除
+        static void rename(const httplib::Request &req, httplib::Response &resp);   // 文件改名
 
         static void listShow(const httplib::Request &req, httplib::Response &resp);   // 文件列表展示
         static void uploadShow(const httplib::Request &req, httplib::Response &resp); // 上传页面展示
         static void updateList(const httplib::Request &req, httplib::Response &resp); // 前端更新文件列表
+        static void metrics(const httplib::Request &req, httplib::Response &resp);    // 运行指标（Prometheus文本格式）
 
-        static std::string getETag(const std::string &url);
+        static std::string getETag(const BackupInfo &bi);
+        static void reclaim(std::vector<std::string> trash); // 回收已删除的磁盘文件（io执行器中执行）
 
     private:
         int _svr_port;                   // 端口号
         std::string _svr_ip;             // 服务端ip
         httplib::Server _svr;            // 服务器
+        std::atomic<bool> _stopping;     // stop已被调用
+        std::atomic<bool> _returned;     // run已返回（或不会再开始监听）
         static UserManager _userManager; // 用户管理
     };
     UserManager Service::_userManager;
 }
 
 Cloud::Service::Service()
+    : _stopping(false), _returned(false)
 {
     Config *conf = Config::getInstance();
     _svr_port = conf->getSvrPort();
@@ -65,16 +76,35 @@ void Cloud::Service::run()
 
     _svr.Post("/upload", upload);       // 文件上传
     _svr.Get("/download/.*", download); // 文件下载
+    _svr.Post("/delete", remove);       // 文件删除
+    _svr.Post("/rename", rename);       // 文件改名
 
     _svr.Get("/uploadShow", uploadShow); // 文件上传展示页面
     _svr.Get("/list", listShow);         // 文件列表展示
     _svr.Get("/file-list", updateList);  // 前端页面更新文件列表
+    _svr.Get("/metrics", metrics);       // 运行指标（需登录）
 
+    if (_stopping)
+    {
+        _returned = true;
+        return;
+    }
     if (!_svr.listen("0.0.0.0", _svr_port))
     {
         _logger->_fatal("服务器监听失败 %s", strerror(errno));
         exit(-2);
     }
+    _returned = true;
+    _logger->_info("业务处理模块停止");
+}
+
+void Cloud::Service::stop()
+{
+    // httplib在listen开始之前调用stop不起作用：run看到_stopping则不再监听，否则等它开始监听后再停止
+    _stopping = true;
+    while (!_returned && !_svr.is_running())
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    _svr.stop();
 }
 
 void Cloud::Service::index(const httplib::Request &req, httplib::Response &resp)
@@ -208,6 +238,9 @@ void Cloud::Service::upload(const httplib::Request &req, httplib::Response &resp
     // 根据上传文件的用户名，存储到对应用户的文件中（注册时已创建），构建对应的文件路径
     std::string backupPath = Config::getInstance()->getBackupDir() + dirName + fileData.filename;
 
+    // 同名文件可能正在压缩：先清除压缩标志，压缩结束时写回失败，压缩包被丢弃，新内容不会被删除
+    _biManager->cancelPacking(PathLayout::get().url_prefix + dirName + fileData.filename);
+
     Util::FileUtil fu(backupPath);
     if (!fu.setContent(fileData.content))
     {
@@ -219,7 +252,7 @@ void Cloud::Service::upload(const httplib::Request &req, httplib::Response &resp
 
     // 4.添加备份信息（文件元信息）
     BackupInfo newbi(backupPath, userID);
-    if (!_biManager->update(newbi.url, newbi))
+    if (!_biManager->update(newbi.url(), newbi))
     {
         _logger->_warn("用户文件备份信息添加失败: %s", backupPath.c_str());
         return;
@@ -245,13 +278,25 @@ void Cloud::Service::download(const httplib::Request &req, httplib::Response &re
         return;
     }
 
-    // 1.ETag缓存判断机制
+    // 1.以URL查找文件（只读视图，整个请求只查一次元信息）
+    BackupInfo::Ptr bi = _biManager->getOneByURL(req.path);
+    if (!bi)
+    {
+        // 文件不存在
+        resp.status = 404;
+        resp.set_content("File not found", "text/plain");
+        return;
+    }
+    std::string etag = getETag(*bi);
+    _biManager->recordAccess(bi, time(nullptr)); // 记录下载热度，推迟冷却时刻
+
+    // 2.ETag缓存判断机制
     if (req.has_header("If-None-Match"))
     {
         std::string oldETag = req.get_header_value("If-None-Match");
 
         // 对比请求头中的ETag和服务器本地文件的ETag是否匹配
-        if (oldETag == getETag(req.path))
+        if (oldETag == etag)
         {
             // 匹配
             resp.status = 304;
@@ -260,29 +305,55 @@ void Cloud::Service::download(const httplib::Request &req, httplib::Response &re
         }
     }
 
-    // 2.以URL查找文件
-    BackupInfo bi;
-    if (!_biManager->getOneByURL(req.path, &bi))
+    // 3.非热点文件：按块从压缩包解压（解压缓存）直接提供给响应，文件保持压缩状态，不改写磁盘和元信息
+    // 只解压响应（或Range）覆盖到的块；频繁下载的文件由下载热度决定不再压缩，这里不需要解压回backup_dir
+    static Counter &packedDownloads = Metrics::getInstance().counter(
+        "cloud_downloads_total", "Download requests by file state", Metrics::label("packed", "true"));
+    static Counter &plainDownloads = Metrics::getInstance().counter(
+        "cloud_downloads_total", "Download requests by file state", Metrics::label("packed", "false"));
+    (bi->pack_flag ? packedDownloads : plainDownloads).inc();
+    if (bi->pack_flag == true)
     {
-        // 文件不存在
-        resp.status = 404;
-        resp.set_content("File not found", "text/plain");
-        return;
-    }
-
-    // 3.判断文件是否为热点文件，若不是，需要先解压
-    // 若文件正在压缩中，需要等待其压缩结束，再解压
-
-    if (bi.pack_flag == true)
-    {
-        // 非热点文件 -> 热点文件
-        Util::FileUtil fu(bi.pack_path);
-        fu.uncompress(bi.real_path);
-        bi.pack_flag = false;
-        fu.remove();
-        _biManager->update(bi.url, bi);
+        auto reader = std::make_shared<PackReader>(bi->packPath());
+        if (!reader->open() || reader->size() != bi->fsize)
+        {
+            _logger->_warn("压缩文件打开失败: %s", bi->packPath().c_str());
+            resp.status = 500;
+            resp.set_content("Pack corrupted", "text/plain");
+            return;
+        }
 
-        _logger->_debug("热点文件: %s 处理成功", bi.real_path.c_str());
+        // 响应结束（发送完或客户端断开）时取消还没开始的预先解压
+        ckf::CancelToken prefetch = ckf::CancelToken::create();
+        if (reader->size() == 0)
+            resp.set_content("", "application/octet-stream");
+        else
+            resp.set_content_provider(reader->size(), "application/octet-stream",
+                                      [reader, prefetch](size_t offset, size_t length, httplib::DataSink &sink)
+                                      {
+                                          // 每次写出offset所在块中的部分，cpp-httplib按写出的长度推进offset
+                                          size_t i = reader->blockOf(offset);
+                                          PackCache::Data block = PackCache::getInstance().get(*reader, i);
+                                          size_t in = offset - reader->blockOffset(i);
+                                          if (!block || in >= block->size())
+                                              return false;
+                                          if (length > block->size() - in) // 还要发送下一块：发送本块时预先解压
+                                              PackCache::getInstance().prefetch(reader, i + 1, prefetch);
+                                          return sink.write(block->data() + in, std::min(length, block->size() - in));
+                                      },
+                                      [prefetch](bool)
+                                      { prefetch.cancel(); });
+        std::string filename = bi->rel_path.substr(bi->rel_path.find_last_of('/') + 1);
+        resp.set_header("Content-Disposition", "attachment; filename=" + filename);
+        resp.set_header("ETag", etag);
+        resp.set_header("Accept-Ranges", "bytes");
+
+        // 断点续传：If-Range与当前etag一致（或没有If-Range）时由cpp-httplib按Range截取，否则返回完整内容
+        if (!req.ranges.empty() && (!req.has_header("If-Range") || req.get_header_value("If-Range") == etag))
+            resp.status = 206;
+        else
+            resp.status = 200;
+        return;
     }
 
     // 判断是否为断点续传请求
@@ -291,12 +362,12 @@ void Cloud::Service::download(const httplib::Request &req, httplib::Response &re
         // 判断客户端的etag是否与当前etag相等
         // 若不相等，表示服务端对文件进行了修改，客户端不能进行断点续传，需要重新下载
         std::string old_etag = req.get_header_value("If-Range");
-        if (old_etag == getETag(req.path))
+        if (old_etag == etag)
         {
-            Util::FileUtil fu(bi.real_path);
-            fu.getContent(resp.body); // cpp-httplib库内置处理断点续传
+            // cpp-httplib库内置处理断点续传：按Range从mmap的文件中写出，不把整个文件读入内存
+            resp.set_file_content(bi->realPath());
 
-            resp.set_header("ETag", getETag(req.path));
+            resp.set_header("ETag", etag);
             resp.set_header("Accept-Ranges", "bytes");
             resp.status = 206;
             resp.reason = "Partial Content";
@@ -305,12 +376,12 @@ void Cloud::Service::download(const httplib::Request &req, httplib::Response &re
     }
 
     // 4.获取文件内容，填充响应
-    resp.set_file_content(bi.real_path);
+    resp.set_file_content(bi->realPath());
     // 设置 Content-Disposition 以便下载文件而不是直接在浏览器显示
-    std::string filename = Util::FileUtil(bi.real_path).fileName();
+    std::string filename = Util::FileUtil(bi->realPath()).fileName();
     resp.set_header("Content-Disposition", "attachment; filename=" + filename);
     // 设置ETag
-    resp.set_header("ETag", getETag(req.path));
+    resp.set_header("ETag", etag);
     // 设置接受断点续传
     resp.set_header("Accept-Ranges", "bytes");
     // 设置状态码和状态描述
@@ -318,6 +389,134 @@ void Cloud::Service::download(const httplib::Request &req, httplib::Response &re
     resp.reason = "OK";
 }
 
+void Cloud::Service::remove(const httplib::Request &req, httplib::Response &resp)
+{
+    // 0.获取sessionID
+    auto it = req.headers.find("Cookie");
+    std::string sessionID = it->second.substr(it->second.find("=") + 1);
+
+    // sessionID不存在，重新登录，以获取新的sessionID
+    if (!_userManager.checkSessionID(sessionID))
+    {
+        resp.set_redirect("/");
+        return;
+    }
+
+    // 1.请求体：{"url": "/download/用户目录/文件名"}
+    Json::Value root;
+    if (!Util::JsonUtil::unserialize(req.body, &root) || !root["url"].isString())
+    {
+        resp.status = 400;
+        resp.set_content("Invalid request", "text/plain");
+        return;
+    }
+    std::string url = root["url"].asString();
+
+    // 2.只能删除自己的文件
+    BackupInfo::Ptr bi = _biManager->getOneByURL(url);
+    if (!bi)
+    {
+        resp.status = 404;
+        resp.set_content("File not found", "text/plain");
+        return;
+    }
+    if (bi->userID != _userManager.sessionUserID(sessionID))
+    {
+        resp.status = 403;
+        resp.set_content("Forbidden", "text/plain");
+        return;
+    }
+
+    // 3.删除元信息（墓碑落盘后返回），磁盘文件交给io执行器回收
+    std::vector<std::string> trash;
+    if (!_biManager->remove(url, &trash))
+    {
+        resp.status = 409;
+        resp.set_content("File is busy, try again later", "text/plain");
+        return;
+    }
+    if (!trash.empty())
+        ckf::ThreadPool::getInstance(ckf::ThreadPool::IO).post(ckf::ThreadPool::LV3, reclaim, std::move(trash));
+    if (bi->pack_flag)
+        PackCache::getInstance().erase(bi->packPath());
+
+    resp.status = 200;
+    resp.set_content("Delete successful", "text/plain");
+    _logger->_debug("用户文件已删除: %s", url.c_str());
+}
+
+void Cloud::Service::rename(const httplib::Request &req, httplib::Response &resp)
+{
+    // 0.获取sessionID
+    auto it = req.headers.find("Cookie");
+    std::string sessionID = it->second.substr(it->second.find("=") + 1);
+
+    // sessionID不存在，重新登录，以获取新的sessionID
+    if (!_userManager.checkSessionID(sessionID))
+    {
+        resp.set_redirect("/");
+        return;
+    }
+
+    // 1.请求体：{"url": "/download/用户目录/文件名", "name": "新文件名"}
+    Json::Value root;
+    if (!Util::JsonUtil::unserialize(req.body, &root) || !root["url"].isString() || !root["name"].isString())
+    {
+        resp.status = 400;
+        resp.set_content("Invalid request", "text/plain");
+        return;
+    }
+    std::string url = root["url"].asString();
+    std::string name = root["name"].asString();
+    if (name.empty() || name == "." || name == ".." || name.find('/') != std::string::npos)
+    {
+        resp.status = 400;
+        resp.set_content("Invalid file name", "text/plain");
+        return;
+    }
+
+    // 2.只能改自己的文件
+    BackupInfo::Ptr bi = _biManager->getOneByURL(url);
+    if (!bi)
+    {
+        resp.status = 404;
+        resp.set_content("File not found", "text/plain");
+        return;
+    }
+    if (bi->userID != _userManager.sessionUserID(sessionID))
+    {
+        resp.status = 403;
+        resp.set_content("Forbidden", "text/plain");
+        return;
+    }
+
+    // 3.新url：同一用户目录下的新文件名
+    std::string userDir = bi->rel_path.substr(0, bi->rel_path.find('/') + 1);
+    std::string newURL = Config::getInstance()->getUrlPrefix() + userDir + name;
+    if (!_biManager->rename(url, newURL))
+    {
+        resp.status = 409;
+        resp.set_content("File name exists or file is busy", "text/plain");
+        return;
+    }
+    if (bi->pack_flag)
+        PackCache::getInstance().erase(bi->packPath());
+
+    resp.status = 200;
+    resp.set_content("Rename successful", "text/plain");
+    _logger->_debug("用户文件改名: %s -> %s", url.c_str(), newURL.c_str());
+}
+
+void Cloud::Service::reclaim(std::vector<std::string> trash)
+{
+    for (const std::string &path : trash)
+    {
+        if (!Util::FileUtil(path).remove())
+            _logger->_warn("回收文件失败: %s", path.c_str());
+    }
+    _logger->_debug("回收已删除文件 %d 个", trash.size());
+}
+
 void Cloud::Service::listShow(const httplib::Request &req, httplib::Response &resp)
 {
     // 获取sessionID
@@ -356,10 +555,6 @@ void Cloud::Service::uploadShow(const httplib::Request &req, httplib::Response &
 
 void Cloud::Service::updateList(const httplib::Request &req, httplib::Response &resp)
 {
-    // 1.获取可下载的文件列表(热点 or 非热点都可下载)
-    std::vector<Cloud::BackupInfo> list;
-    _biManager->getAll(&list);
-
     auto time_tToDateString = [](time_t time)
     {
         struct tm *timeinfo = std::localtime(&time);
@@ -385,7 +580,7 @@ void Cloud::Service::updateList(const httplib::Request &req, httplib::Response &
             return std::to_string(sz / G) + "GB";
     };
 
-    // 2.获取sessionID，表明当前用户，只返回当前用户的文件信息
+    // 1.获取sessionID，表明当前用户，只返回当前用户的文件信息
     auto it = req.headers.find("Cookie");
     std::string sessionID = it->second.substr(it->second.find("=") + 1);
 
@@ -395,28 +590,78 @@ void Cloud::Service::updateList(const httplib::Request &req, httplib::Response &
         assert(false);
     }
 
+    // 2.解析分页参数：?after=&offset=&limit=&sort=，sort取name/mtime/size，前缀'-'表示降序
+    //   after是上一页返回的next游标，按游标翻页不必逐项跳过；limit缺省为page_limit_default，最多page_limit_max
+    static const size_t page_limit_default = 50, page_limit_max = 1000;
+    std::string after = req.has_param("after") ? req.get_param_value("after") : "";
+    size_t offset = 0, limit = page_limit_default;
+    try
+    {
+        if (req.has_param("offset"))
+            offset = std::stoul(req.get_param_value("offset"));
+        if (req.has_param("limit"))
+            limit = std::stoul(req.get_param_value("limit"));
+    }
+    catch (const std::exception &e)
+    {
+        resp.status = 400;
+        resp.set_content("Invalid offset or limit", "text/plain");
+        return;
+    }
+    if (limit == 0 || limit > page_limit_max)
+        limit = page_limit_max;
+
+    std::string sort = req.has_param("sort") ? req.get_param_value("sort") : "name";
+    bool desc = !sort.empty() && sort[0] == '-';
+    if (desc)
+        sort = sort.substr(1);
+
+    BackupInfoManager::SortKey sortKey;
+    if (sort == "name")
+        sortKey = BackupInfoManager::SORT_BY_NAME;
+    else if (sort == "mtime")
+        sortKey = BackupInfoManager::SORT_BY_MTIME;
+    else if (sort == "size")
+        sortKey = BackupInfoManager::SORT_BY_SIZE;
+    else
+    {
+        resp.status = 400;
+        resp.set_content("Invalid sort key", "text/plain");
+        return;
+    }
+
+    // 3.只取当前用户的这一页文件(热点 or 非热点都可下载)
+    std::vector<Cloud::BackupInfo::Ptr> list;
+    size_t total = 0;
+    std::string next;
+    if (!_biManager->getPageByUser(userID, after, offset, limit, sortKey, desc, &list, &total, &next))
+    {
+        resp.status = 400;
+        resp.set_content("Invalid cursor", "text/plain");
+        return;
+    }
+
     Json::Value root;
 
-    // 3.获取用户名
+    // 4.获取用户名
     std::string username = _userManager.userName(userID);
     root["username"] = username;
+    root["total"] = static_cast<Json::UInt64>(total);
+    root["offset"] = static_cast<Json::UInt64>(offset);
+    root["next"] = next; // 为空表示没有下一页
 
-    // 3.遍历文件信息，组织成json
-    Json::Value fileList;
+    // 5.遍历文件信息，组织成json
+    Json::Value fileList(Json::arrayValue);
     for (auto &info : list)
     {
-        if (info.userID == userID)
-        {
-            Json::Value item;
-            Config *conf = Config::getInstance();
-            item["downloadUrl"] = info.url;
+        Json::Value item;
+        item["downloadUrl"] = info->url();
 
-            item["fileName"] = info.url.substr(info.url.find_last_of('/') + 1);
-            item["fileSize"] = size_tToString(info.fsize);
-            item["lastModified"] = time_tToDateString(info.mtime);
+        item["fileName"] = info->rel_path.substr(info->rel_path.find_last_of('/') + 1);
+        item["fileSize"] = size_tToString(info->fsize);
+        item["lastModified"] = time_tToDateString(info->mtime);
 
-            fileList.append(item);
-        }
+        fileList.append(item);
     }
     root["files"] = fileList;
 
@@ -425,14 +670,28 @@ void Cloud::Service::updateList(const httplib::Request &req, httplib::Response &
     resp.set_content(jsonStr, "application/json");
 }
 
-std::string Cloud::Service::getETag(const std::string &url)
+void Cloud::Service::metrics(const httplib::Request &req, httplib::Response &resp)
+{
+    // 与其它页面相同的会话校验；抓取端通常不带Cookie，须先判断头是否存在
+    auto it = req.headers.find("Cookie");
+    std::string sessionID = it == req.headers.end() ? "" : it->second.substr(it->second.find("=") + 1);
+    if (!_userManager.checkSessionID(sessionID))
+    {
+        resp.status = 401; // Unauthorized
+        return;
+    }
+
+    resp.set_content(Metrics::getInstance().render(), "text/plain; version=0.0.4");
+    resp.status = 200;
+}
+
+std::string Cloud::Service::getETag(const BackupInfo &bi)
 {
-    Cloud::BackupInfo bi;
-    _biManager->getOneByURL(url, &bi);
-
-    // 文件名-文件大小-最近修改时间
-    std::string fileName = Util::FileUtil(bi.real_path).fileName();
-    std::string fileSize = std::to_string(bi.fsize);
-    std::string lastMTime = std::to_string(bi.mtime);
-    return fileName + '-' + fileSize + '-' + lastMTime;
+    // 文件名-文件大小-最近修改时间：文件名取自rel_path，在栈上拼好，只构造一次string
+    std::string_view rel = bi.rel_path;
+    std::string_view fileName = rel.substr(rel.rfind('/') + 1);
+    char buf[NAME_MAX + 48];
+    int n = snprintf(buf, sizeof(buf), "%.*s-%llu-%lld", (int)fileName.size(), fileName.data(),
+                     (unsigned long long)bi.fsize, (long long)bi.mtime);
+    return std::string(buf, std::min<size_t>(n, sizeof(buf) - 1));
 }
@@ -0,0 +1,230 @@
+#pragma once
+#include <sys/mman.h>
+#include <cstring>
+#include "util.hh"
+
+namespace Cloud
+{
+    // 备份信息二进制快照
+    // 文件布局：| Header | Record * count | 字符串堆 |
+    // Record定长，其中的相对路径存放在字符串堆中，
+    // 加载时mmap整个文件，顺序扫描一遍Record数组即可，无需解析
+    class Snapshot
+    {
+    public:
+        struct Header
+        {
+            char magic[8];        // "CLDSNAP1"
+            uint32_t version;     // 格式版本
+            uint32_t record_size; // sizeof(Record)，用于校验
+            uint64_t count;       // 记录数
+            uint64_t heap_size;   // 字符串堆大小
+            uint64_t checksum;    // Record数组与字符串堆的FNV-1a校验和
+        };
+
+        struct Record
+        {
+            uint64_t fsize;     // 文件大小
+            int64_t atime;      // 最近访问时间
+            int64_t mtime;      // 最近修改时间
+            uint64_t heap_off;  // 相对路径在堆中的起始偏移
+            uint32_t path_len;  // 相对路径长度
+            int32_t userID;     // 所属用户id
+            uint8_t flags;      // FLAG_PACKED
+            uint8_t codec;      // 压缩算法
+            uint8_t reserved[6];
+        };
+
+        enum
+        {
+            FLAG_PACKED = 0x1
+        };
+
+        static const uint32_t version = 1;
+
+    public:
+        Snapshot(const std::string &path);
+        ~Snapshot();
+
+        void add(const BackupInfo &bi); // 追加一条记录（写快照）
+        bool commit();                  // 原子地写出快照文件
+
+        bool open();                    // mmap快照文件并校验（读快照）
+        size_t size() const;            // 记录数
+        void get(size_t i, BackupInfo *bi) const; // 取出第i条记录
+
+        static bool convertFromJson(const std::string &jsonPath, const std::string &snapPath); // 从旧的Json备份文件转换
+        static uint64_t checksum(const char *data, size_t len); // FNV-1a校验和（段文件也使用）
+
+    private:
+        std::string _path;
+        std::vector<Record> _records; // 写快照时暂存
+        std::string _heap;
+        const char *_map;             // 读快照时的映射
+        size_t _map_len;
+        const Header *_header;
+        const char *_rec_base;        // Record数组
+        const char *_heap_base;
+    };
+}
+
+Cloud::Snapshot::Snapshot(const std::string &path)
+    : _path(path), _map(nullptr), _map_len(0), _header(nullptr), _rec_base(nullptr), _heap_base(nullptr)
+{
+}
+
+Cloud::Snapshot::~Snapshot()
+{
+    if (_map)
+        munmap((void *)_map, _map_len);
+}
+
+void Cloud::Snapshot::add(const BackupInfo &bi)
+{
+    Record r;
+    memset(&r, 0, sizeof(r));
+    r.fsize = bi.fsize;
+    r.atime = bi.atime;
+    r.mtime = bi.mtime;
+    r.heap_off = _heap.size();
+    r.path_len = bi.rel_path.size();
+    r.userID = bi.userID;
+    r.flags = bi.pack_flag ? FLAG_PACKED : 0;
+    r.codec = bi.codec;
+    _records.push_back(r);
+
+    _heap += bi.rel_path;
+}
+
+bool Cloud::Snapshot::commit()
+{
+    Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "CLDSNAP1", sizeof(h.magic));
+    h.version = version;
+    h.record_size = sizeof(Record);
+    h.count = _records.size();
+    h.heap_size = _heap.size();
+
+    // Header + Record数组 + 字符串堆，整体一次写出
+    std::string content;
+    content.reserve(sizeof(Header) + _records.size() * sizeof(Record) + _heap.size());
+    content.append((const char *)&h, sizeof(h));
+    content.append((const char *)_records.data(), _records.size() * sizeof(Record));
+    content.append(_heap);
+
+    Header *ph = (Header *)&content[0];
+    ph->checksum = checksum(content.data() + sizeof(Header), content.size() - sizeof(Header));
+
+    Util::FileUtil fu(_path);
+    if (!fu.atomicSetContent(content))
+    {
+        DF_ERROR("%s: Snapshot write failed", _path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool Cloud::Snapshot::open()
+{
+    int fd = ::open(_path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        DF_ERROR("%s: Snapshot open failed", _path.c_str());
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(Header))
+    {
+        DF_ERROR("%s: Snapshot too short", _path.c_str());
+        ::close(fd);
+        return false;
+    }
+
+    void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+    {
+        DF_ERROR("%s: Snapshot mmap failed", _path.c_str());
+        return false;
+    }
+    madvise(p, st.st_size, MADV_SEQUENTIAL); // 只会顺序扫描一遍
+    _map = (const char *)p;
+    _map_len = st.st_size;
+
+    // 校验头部、长度与校验和
+    _header = (const Header *)_map;
+    if (memcmp(_header->magic, "CLDSNAP1", sizeof(_header->magic)) != 0 ||
+        _header->version != version || _header->record_size != sizeof(Record) ||
+        sizeof(Header) + _header->count * sizeof(Record) + _header->heap_size != _map_len)
+    {
+        DF_ERROR("%s: Snapshot header invalid", _path.c_str());
+        return false;
+    }
+    if (checksum(_map + sizeof(Header), _map_len - sizeof(Header)) != _header->checksum)
+    {
+        DF_ERROR("%s: Snapshot checksum mismatch", _path.c_str());
+        return false;
+    }
+
+    _rec_base = _map + sizeof(Header);
+    _heap_base = _map + sizeof(Header) + _header->count * sizeof(Record);
+    return true;
+}
+
+size_t Cloud::Snapshot::size() const
+{
+    return _header ? _header->count : _records.size();
+}
+
+void Cloud::Snapshot::get(size_t i, BackupInfo *bi) const
+{
+    const Record &r = ((const Record *)_rec_base)[i];
+    bi->fsize = r.fsize;
+    bi->atime = r.atime;
+    bi->mtime = r.mtime;
+    bi->userID = r.userID;
+    bi->pack_flag = r.flags & FLAG_PACKED;
+    bi->is_packing = false;
+    bi->codec = r.codec;
+    bi->rel_path.assign(_heap_base + r.heap_off, r.path_len);
+}
+
+bool Cloud::Snapshot::convertFromJson(const std::string &jsonPath, const std::string &snapPath)
+{
+    std::string content;
+    Util::FileUtil fu(jsonPath);
+    if (!fu.getContent(content))
+    {
+        DF_ERROR("%s: Read json backup failed", jsonPath.c_str());
+        return false;
+    }
+
+    Json::Value root;
+    if (!content.empty() && !Util::JsonUtil::unserialize(content, &root))
+    {
+        DF_ERROR("%s: Json unserialize failed", jsonPath.c_str());
+        return false;
+    }
+
+    Snapshot snap(snapPath);
+    for (Json::ArrayIndex i = 0; i < root.size(); i++)
+    {
+        BackupInfo bi;
+        bi.fromJson(root[i]);
+        snap.add(bi);
+    }
+    return snap.commit();
+}
+
+uint64_t Cloud::Snapshot::checksum(const char *data, size_t len)
+{
+    uint64_t h = 1469598103934665603ULL; // FNV-1a
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
@@ -0,0 +1,186 @@
+#pragma once
+#include <memory>
+#include <functional>
+#include "util.hh"
+#include "journal.hh"
+#include "snapshot.hh"
+
+namespace Cloud
+{
+    struct MetaChange // 一次元信息修改
+    {
+        std::string rel;      // 相对路径
+        BackupInfo::Ptr info; // 修改后的记录，nullptr表示删除
+    };
+
+    // 元信息存储后端：负责把修改持久化，并在启动时交回已持久化的数据
+    // 不带索引的后端（journal）启动时交回全部数据，内存中的分片表是完整的服务缓存；
+    // 带索引的后端（lsm）直接服务点查和前缀扫描，分片表只保存运行时状态（正在压缩的记录）
+    class MetaStore
+    {
+    public:
+        using Ptr = std::unique_ptr<MetaStore>;
+        using Loader = std::function<void(const std::string &rel, const BackupInfo *bi)>; // bi为nullptr表示删除
+        using Visitor = std::function<void(const BackupInfo &bi)>;
+        using Dumper = std::function<void(const Visitor &visit)>;                         // 遍历内存表中的全部记录
+
+        virtual ~MetaStore() {}
+
+        virtual bool open(const Loader &cb) = 0;                      // 打开存储，按顺序交回已持久化的数据
+        // 持久化一批修改（返回时已落盘）；durable为false时只写入，落盘由之后的sync完成
+        virtual bool write(const std::vector<MetaChange> &changes, bool durable = true) = 0;
+        virtual bool sync() = 0;                                      // 落盘此前durable为false写入的修改
+        virtual bool needCheckpoint() = 0;                            // 是否需要整理
+        virtual bool checkpoint(const Dumper &dump) = 0;              // 整理（期间允许write，dump看到的记录不早于整理开始时）
+
+        // 带索引的后端：write之后立即可以查到，open不需要交回数据
+        virtual bool indexed() { return false; }
+        virtual BackupInfo::Ptr get(std::string_view /*rel*/) { return nullptr; } // 点查，不存在时返回nullptr
+        // 按key升序取出前缀为prefix、key大于after（为空则从头）的记录，至多limit条（limit为0表示不限）
+        virtual void scan(const std::string & /*prefix*/, const std::string & /*after*/, size_t /*limit*/,
+                          std::vector<BackupInfo::Ptr> * /*out*/) {}
+
+        static Ptr create(); // 按配置meta_backend创建后端
+    };
+
+    // journal后端：二进制快照 + 追加日志，整理时把整张表写成新快照并清空日志
+    class JournalStore : public MetaStore
+    {
+    public:
+        JournalStore(const std::string &snapshotFile, const std::string &journalFile, const std::string &managerFile);
+
+        bool open(const Loader &cb) override;
+        bool write(const std::vector<MetaChange> &changes, bool durable = true) override;
+        bool sync() override;
+        bool needCheckpoint() override;
+        bool checkpoint(const Dumper &dump) override;
+
+    private:
+        std::string _snapshot_file; // 备份文件数据二进制快照
+        std::string _manager_file;  // 旧的Json备份文件，仅在没有快照时用于转换
+        Journal _journal;           // 快照之后的修改记录（追加日志）
+        size_t _compact_threshold;  // 日志记录数达到该值时压实为快照
+    };
+}
+
+#include "lsm.hh"
+
+Cloud::MetaStore::Ptr Cloud::MetaStore::create()
+{
+    Cloud::Config *conf = Cloud::Config::getInstance();
+    if (conf->getMetaBackend() == "lsm")
+        return Ptr(new LsmStore(conf->getMetaDir()));
+    return Ptr(new JournalStore(conf->getSnapshotFile(), conf->getJournalFile(), conf->getManagerFile()));
+}
+
+// JournalStore
+Cloud::JournalStore::JournalStore(const std::string &snapshotFile, const std::string &journalFile, const std::string &managerFile)
+    : _snapshot_file(snapshotFile), _manager_file(managerFile), _journal(journalFile),
+      _compact_threshold(Cloud::Config::getInstance()->getCompactThreshold())
+{
+}
+
+bool Cloud::JournalStore::open(const Loader &cb)
+{
+    // 1.还没有二进制快照，但有旧的Json备份文件：先转换
+    Util::FileUtil snapFile(_snapshot_file);
+    Util::FileUtil jsonFile(_manager_file);
+    if (!snapFile.isExists() && jsonFile.isExists())
+    {
+        if (!Snapshot::convertFromJson(_manager_file, _snapshot_file))
+        {
+            DF_ERROR("Convert json backup to snapshot failed");
+            return false;
+        }
+        _logger->_info("旧的Json备份文件 %s 已转换为快照 %s", _manager_file.c_str(), _snapshot_file.c_str());
+    }
+
+    // 2.mmap快照，顺序扫描一遍
+    if (snapFile.isExists())
+    {
+        Snapshot snap(_snapshot_file);
+        if (!snap.open())
+            return false;
+
+        BackupInfo bi;
+        for (size_t i = 0; i < snap.size(); i++)
+        {
+            snap.get(i, &bi);
+            cb(bi.rel_path, &bi);
+        }
+    }
+
+    // 3.回放快照之后的修改记录
+    bool ok = _journal.replay([&cb](const Json::Value &record)
+    {
+        const std::string op = record["op"].asString();
+        if (op == "put")
+        {
+            BackupInfo bi;
+            bi.fromJson(record["info"]);
+            cb(bi.rel_path, &bi);
+        }
+        else if (op == "del")
+        {
+            const std::string url = record["url"].asString();
+            std::string_view rel;
+            if (PathLayout::get().relOfURL(url, &rel))
+                cb(std::string(rel), nullptr);
+        }
+    });
+    if (!ok || !_journal.open())
+        return false;
+
+    _logger->_debug("备份信息快照加载完成, 回放日志记录 %d 条", _journal.records());
+    return true;
+}
+
+bool Cloud::JournalStore::write(const std::vector<MetaChange> &changes, bool durable)
+{
+    std::vector<Json::Value> records;
+    records.reserve(changes.size());
+    for (const MetaChange &c : changes)
+    {
+        Json::Value record;
+        if (c.info)
+        {
+            record["op"] = "put";
+            record["info"] = c.info->toJson();
+        }
+        else
+        {
+            record["op"] = "del";
+            record["url"] = PathLayout::get().url_prefix + c.rel;
+        }
+        records.push_back(std::move(record));
+    }
+    return _journal.append(records, durable);
+}
+
+bool Cloud::JournalStore::sync()
+{
+    return _journal.sync();
+}
+
+bool Cloud::JournalStore::needCheckpoint()
+{
+    return _journal.records() >= _compact_threshold;
+}
+
+bool Cloud::JournalStore::checkpoint(const Dumper &dump)
+{
+    // 1.先记下日志的结尾，再收集所有文件元信息写成二进制快照：
+    //   此前的记录都已包含在快照里，整理期间追加的记录留在日志中
+    Journal::Mark upto = _journal.mark();
+    Snapshot snap(_snapshot_file);
+    dump([&snap](const BackupInfo &bi)
+         { snap.add(bi); });
+
+    // 2.原子地替换快照，成功后丢弃upto之前的日志记录
+    if (!snap.commit())
+    {
+        DF_ERROR("Set snapshot file failed");
+        return false;
+    }
+    return _journal.reset(upto);
+}
@@ -1,16 +1,171 @@
 #pragma once
-#include <iostream>
-#include <queue>
+#include <deque>
+#include <vector>
 #include <functional>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
 #include <future>
+#include <tuple>
+#include <type_traits>
+#include <chrono>
+#include <cmath>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #include "log/ckflog.hpp"
+#include "config.hh"
+#include "metrics.hh"
+
+extern ckflogs::Logger::Ptr _logger;
 
 namespace ckf
 {
+    // 只能移动的可调用对象：不超过inline_size的可调用对象（lambda及其捕获、packaged_task）直接存放在对象内部，
+    // 更大的才在堆上分配；相比std::function不要求可拷贝，移动时不分配
+    class Task
+    {
+    public:
+        static const size_t inline_size = 64;
+
+        Task() noexcept : _ops(nullptr) {}
+        template <typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, Task>::value>::type>
+        Task(F &&f);
+        Task(Task &&other) noexcept;
+        Task &operator=(Task &&other) noexcept;
+        Task(const Task &other) = delete;
+        Task &operator=(const Task &other) = delete;
+        ~Task();
+
+        void operator()() { _ops->invoke(_buf); }
+        explicit operator bool() const { return _ops != nullptr; }
+        void reset(); // 释放可调用对象及其捕获
+
+    private:
+        struct Ops
+        {
+            void (*invoke)(void *buf);
+            void (*move)(void *dst, void *src); // 移动到dst，并销毁src中的对象
+            void (*destroy)(void *buf);
+        };
+
+        template <typename Fn>
+        struct InlineOps // 可调用对象存放在_buf中
+        {
+            static void invoke(void *buf) { (*static_cast<Fn *>(buf))(); }
+            static void move(void *dst, void *src)
+            {
+                new (dst) Fn(std::move(*static_cast<Fn *>(src)));
+                static_cast<Fn *>(src)->~Fn();
+            }
+            static void destroy(void *buf) { static_cast<Fn *>(buf)->~Fn(); }
+            static const Ops ops;
+        };
+
+        template <typename Fn>
+        struct HeapOps // _buf中只存放指针
+        {
+            static void invoke(void *buf) { (**static_cast<Fn **>(buf))(); }
+            static void move(void *dst, void *src) { *static_cast<Fn **>(dst) = *static_cast<Fn **>(src); }
+            static void destroy(void *buf) { delete *static_cast<Fn **>(buf); }
+            static const Ops ops;
+        };
+
+        alignas(std::max_align_t) unsigned char _buf[inline_size];
+        const Ops *_ops;
+    };
+
+    // 取消令牌：拷贝之间共享同一个标志，由create()创建，默认构造的令牌永远不会被取消
+    // 提交时附带的令牌被取消后，尚未开始执行的任务直接丢弃（future得到broken_promise）；
+    // 已开始执行的任务可以自行检查cancelled()提前结束（协作式取消）
+    class CancelToken
+    {
+    public:
+        CancelToken() = default;
+        static CancelToken create();
+
+        void cancel() const;
+        bool cancelled() const;
+
+    private:
+        std::shared_ptr<std::atomic<bool>> _flag;
+    };
+
+    // 队列中的任务节点：由TaskNodePool复用，提交任务时不再为节点分配内存
+    struct TaskNode
+    {
+        Task task;
+        unsigned priority = 0; // TaskPriority
+        CancelToken token;
+        std::chrono::steady_clock::time_point enqueued; // 入队时刻，用于统计排队时间
+    };
+
+    // 任务节点池：每个线程缓存一批空闲节点，缓存空或满时与全局空闲表成批交换，
+    // 提交线程与执行线程不同时，节点也能在二者之间循环使用
+    class TaskNodePool
+    {
+    public:
+        static TaskNode *alloc();
+        static void free(TaskNode *node); // 节点中的任务须已reset
+
+    private:
+        static constexpr size_t cache_max = 128;  // 线程缓存上限
+        static constexpr size_t batch = 64;       // 与全局空闲表一次交换的个数
+        static constexpr size_t global_max = 8192; // 全局空闲表上限，超出的直接释放
+
+        struct Global
+        {
+            std::mutex mutex;
+            std::vector<TaskNode *> nodes;
+            ~Global();
+        };
+        struct Cache
+        {
+            std::vector<TaskNode *> nodes;
+            ~Cache(); // 线程退出时归还全局空闲表
+        };
+
+        static Global &global();
+        static Cache &cache();
+    };
+
+    // 工作窃取队列（Chase-Lev）：所有者在底部压入、弹出（后进先出，缓存热），其它线程从顶部窃取（先进先出）
+    // 固定容量的环形数组，满时由调用者改放全局队列；只有top上的CAS，没有锁
+    class WorkDeque
+    {
+    public:
+        using Item = TaskNode *;
+
+        WorkDeque();
+
+        bool push(Item item); // 所有者调用，满时返回false
+        Item pop();           // 所有者调用，空时返回nullptr
+        Item steal();         // 任意线程调用，空或与其它线程冲突时返回nullptr
+        bool empty() const;
+
+    private:
+        static const int64_t capacity = 1024; // 2的幂
+        static const int64_t mask = capacity - 1;
+
+        alignas(64) std::atomic<int64_t> _top;    // 下一个被窃取的位置
+        alignas(64) std::atomic<int64_t> _bottom; // 下一个压入的位置
+        std::atomic<Item> _buffer[capacity];
+    };
+
+    // 工作窃取线程池
+    // 每个工作线程一个WorkDeque，工作线程中提交的任务放入自己的队列；其它线程提交的任务放入全局队列，
+    // 全局队列按TaskPriority分三级，先取高优先级
+    // 工作线程取任务的顺序：自己的队列 -> 全局队列 -> 从其它工作线程窃取，都没有时才在条件变量上休眠
+    // 按用途分为几个互相隔离的执行器，各自的线程数、调度优先级（nice）和CPU绑定取配置executors中的同名项：
+    //   io：阻塞的磁盘操作（元信息压实、回收站清理、启动时的一致性检查）
+    //   cpu：请求路径上的计算（下载时预先解压压缩包的后续块）
+    //   background：不紧急的计算（压缩），默认nice 10，线程数默认按compress_cpu的CPU预算取整
+    // 线程数为0时取默认值：background如上，其余与CPU核数相同
+    // 停止：shutdown先拒绝新任务、丢弃低优先级的排队任务，在期限内执行完其余任务后再停止工作线程
+    // 指标：每个工作线程的执行数、窃取数、排队时间和执行时间直方图（只由该线程写入，没有竞争），
+    // 按优先级的积压数；注册在Metrics中由/metrics导出，stats()汇总为快照供调整线程数使用
     class ThreadPool
     {
     public:
@@ -21,157 +176,711 @@ namespace ckf
             LV3
         };
 
-    private:
-        static const size_t thread_num = 3; // 工作线程个数
-        using Task = std::function<void()>;
-        using TaskPair = std::pair<TaskPriority, Task>; // 带优先级的任务
-        class priComparison
+        enum Executor
         {
-        public:
-            bool operator()(const TaskPair &p1, const TaskPair &p2)
-            {
-                return p1.first > p2.first; // 小根堆，优先级高（TaskPriority小）在前面
-            }
+            IO,
+            CPU,
+            BACKGROUND
         };
 
-        using Threads = std::vector<std::thread *>;
-        using TaskQueue = std::priority_queue<TaskPair, std::vector<TaskPair>, priComparison>;
+    private:
+        static const size_t priority_num = 3;
+
+        struct Worker
+        {
+            WorkDeque deque;
+            std::thread thread;
+            Cloud::Counter &executed; // 执行的任务数
+            Cloud::Counter &steals;   // 从其它线程窃取的任务数
+            Cloud::Histogram &wait;   // 排队时间（秒）
+            Cloud::Histogram &run;    // 执行时间（秒）
+
+            Worker(const std::string &labels); // labels: executor="...",worker="i"，重新start时沿用同一组指标
+        };
 
     public:
-        static ThreadPool &getInstance(); // 获取单例对象
+        // 运行状态快照：计数从线程池创建起累计，直方图为累计计数（上界取latencyBounds）
+        struct Stats
+        {
+            size_t threads = 0;                     // 工作线程数
+            size_t active = 0;                      // 正在执行的任务数
+            size_t sleepers = 0;                    // 休眠的工作线程数
+            size_t backlog[priority_num] = {};      // 各优先级排队的任务数
+            std::vector<uint64_t> executed;         // 各工作线程执行的任务数
+            uint64_t steals = 0;                    // 窃取的任务数
+            uint64_t dropped = 0;                   // 取消或停止时丢弃的任务数
+            std::vector<uint64_t> wait_buckets;     // 排队时间
+            double wait_sum = 0;
+            std::vector<uint64_t> run_buckets;      // 执行时间
+            double run_sum = 0;                     // 累计执行时间，除以经过的时间和线程数即为利用率
+        };
+
+        static ThreadPool &getInstance(Executor which); // 获取指定执行器（每种一个单例）
         void start();                     // 线程池开始工作
+        size_t size() const;              // 工作线程个数
+        const std::string &name() const;  // 执行器名
+        Stats stats() const;              // 运行状态快照（线程池运行期间调用）
+        static const std::vector<double> &latencyBounds(); // 排队、执行时间直方图的桶上界（秒）
         template <typename F, typename... Args>
-        auto submit(const TaskPriority &priLevel, F &&f, Args &&...args) // 提交一个任务到线程池
-            -> std::future<decltype(f(args...))>;
+        using ResultOf = std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>; // 参数按值保存后调用的返回类型
+
+        template <typename F>
+        using NotToken = std::enable_if_t<!std::is_same<std::decay_t<F>, CancelToken>::value>;
+
+        // 提交一个任务到线程池；线程池停止后提交的任务不会执行，future得到broken_promise
+        template <typename F, typename... Args, typename = NotToken<F>>
+        auto submit(const TaskPriority &priLevel, F &&f, Args &&...args)
+            -> std::future<ResultOf<F, Args...>>;
+        template <typename F, typename... Args>
+        auto submit(const TaskPriority &priLevel, const CancelToken &token, F &&f, Args &&...args) // 可取消的任务
+            -> std::future<ResultOf<F, Args...>>;
+        // 提交一个不关心结果的任务（不创建future），线程池停止后返回false
+        template <typename F, typename... Args, typename = NotToken<F>>
+        bool post(const TaskPriority &priLevel, F &&f, Args &&...args);
+        template <typename F, typename... Args>
+        bool post(const TaskPriority &priLevel, const CancelToken &token, F &&f, Args &&...args);
+
+        // 有序停止：1.拒绝新任务 2.优先级低于keep的排队任务丢弃 3.等待其余任务执行完，最多timeout
+        // 4.停止工作线程，仍在排队的任务丢弃。正在执行的任务不会被打断（可通过各自的令牌协作取消）
+        // 在期限内执行完返回true
+        bool shutdown(std::chrono::milliseconds timeout, TaskPriority keep = LV2);
 
     private:
-        ThreadPool();
+        ThreadPool(const std::string &name);
         ~ThreadPool();
         ThreadPool(const ThreadPool &other) = delete;
         ThreadPool& operator=(const ThreadPool &other) = delete;
 
-        void stop();       // 线程池结束工作
-        Task take();       // 从任务队列中取出队列（线程安全）
-        void threadLoop(); // 工作线程执行函数
+        void stop();                           // 线程池结束工作
+        bool push(TaskPriority priLevel, const CancelToken &token, Task &&task); // 放入当前工作线程的队列或全局队列，并按需唤醒
+        TaskNode *take(size_t self);           // 取出一个任务，没有时返回nullptr（不阻塞）
+        bool wait();                           // 没有任务时休眠，线程池停止时返回false
+        void threadLoop(size_t self);          // 工作线程执行函数
+        void setupThread(size_t self);         // 设置线程名、调度优先级和CPU绑定
+        bool dropped(const TaskNode *node) const; // 已取消，或停止时被丢弃的低优先级任务
+
+        static thread_local ThreadPool *_tl_pool; // 当前线程所属的线程池（非工作线程为nullptr）
+        static thread_local size_t _tl_index;     // 当前工作线程的序号
 
     private:
-        Threads _threads;              // 工作线程组
-        TaskQueue _task_queue;         // 任务队列
-        std::mutex _mutex;             // 保护任务队列线程安全
-        std::condition_variable _cond; // 条件变量
-        std::atomic<bool> _isRunning;  // 线程池“工作中”标识 (原子)
+        std::string _name;                             // 执行器名
+        Cloud::ExecutorConf _conf;                     // 执行器配置
+        std::vector<std::unique_ptr<Worker>> _workers; // 工作线程组
+        std::deque<TaskNode *> _inject[priority_num]; // 全局队列，按优先级分级
+        std::mutex _mutex;                            // 保护全局队列和休眠
+        std::condition_variable _cond;                // 条件变量
+        std::atomic<size_t> _pending;                 // 所有队列中的任务数
+        std::atomic<size_t> _sleepers;                // 休眠的工作线程数
+        std::atomic<size_t> _active;                  // 正在执行的任务数
+        std::atomic<size_t> _threads;                 // 工作线程数（供其它线程读取，_workers只由start/stop修改）
+        std::atomic<bool> _isRunning;                 // 线程池“工作中”标识 (原子)
+        std::atomic<bool> _accepting;                 // 是否接受新任务
+        std::atomic<unsigned> _drop_above;            // 优先级低于该值的任务取出时丢弃
+        std::condition_variable _idle_cond;           // 停止期间等待所有任务执行完
+        std::atomic<size_t> _backlog[priority_num];   // 各优先级排队的任务数（各队列之和）
+        Cloud::Counter &_dropped;                     // 丢弃的任务数
     };
 
 }
 
-ckf::ThreadPool &ckf::ThreadPool::getInstance() // C++11之后的单例模式
+// Task
+template <typename Fn>
+const ckf::Task::Ops ckf::Task::InlineOps<Fn>::ops = {&InlineOps<Fn>::invoke, &InlineOps<Fn>::move, &InlineOps<Fn>::destroy};
+
+template <typename Fn>
+const ckf::Task::Ops ckf::Task::HeapOps<Fn>::ops = {&HeapOps<Fn>::invoke, &HeapOps<Fn>::move, &HeapOps<Fn>::destroy};
+
+template <typename F, typename>
+ckf::Task::Task(F &&f)
+{
+    using Fn = typename std::decay<F>::type;
+    if constexpr (sizeof(Fn) <= inline_size && alignof(Fn) <= alignof(std::max_align_t) &&
+                  std::is_nothrow_move_constructible<Fn>::value)
+    {
+        new (_buf) Fn(std::forward<F>(f));
+        _ops = &InlineOps<Fn>::ops;
+    }
+    else
+    {
+        *reinterpret_cast<Fn **>(_buf) = new Fn(std::forward<F>(f));
+        _ops = &HeapOps<Fn>::ops;
+    }
+}
+
+ckf::Task::Task(Task &&other) noexcept
+    : _ops(other._ops)
+{
+    if (_ops)
+        _ops->move(_buf, other._buf);
+    other._ops = nullptr;
+}
+
+ckf::Task &ckf::Task::operator=(Task &&other) noexcept
+{
+    if (this != &other)
+    {
+        reset();
+        _ops = other._ops;
+        if (_ops)
+            _ops->move(_buf, other._buf);
+        other._ops = nullptr;
+    }
+    return *this;
+}
+
+ckf::Task::~Task()
+{
+    reset();
+}
+
+void ckf::Task::reset()
+{
+    if (_ops)
+        _ops->destroy(_buf);
+    _ops = nullptr;
+}
+
+// CancelToken
+ckf::CancelToken ckf::CancelToken::create()
+{
+    CancelToken token;
+    token._flag = std::make_shared<std::atomic<bool>>(false);
+    return token;
+}
+
+void ckf::CancelToken::cancel() const
+{
+    if (_flag)
+        _flag->store(true);
+}
+
+bool ckf::CancelToken::cancelled() const
+{
+    return _flag && _flag->load();
+}
+
+// TaskNodePool
+ckf::TaskNodePool::Global &ckf::TaskNodePool::global()
+{
+    static Global inst;
+    return inst;
+}
+
+ckf::TaskNodePool::Cache &ckf::TaskNodePool::cache()
 {
-    static ThreadPool inst;
+    thread_local Cache inst;
     return inst;
 }
 
-ckf::ThreadPool::ThreadPool()
+ckf::TaskNodePool::Global::~Global()
+{
+    for (TaskNode *node : nodes)
+        delete node;
+}
+
+ckf::TaskNodePool::Cache::~Cache()
 {
+    Global &g = global();
+    std::unique_lock<std::mutex> lck(g.mutex);
+    for (TaskNode *node : nodes)
+    {
+        if (g.nodes.size() < global_max)
+            g.nodes.push_back(node);
+        else
+            delete node;
+    }
+}
+
+ckf::TaskNode *ckf::TaskNodePool::alloc()
+{
+    Cache &c = cache();
+    if (c.nodes.empty())
+    {
+        // 从全局空闲表取一批
+        Global &g = global();
+        std::unique_lock<std::mutex> lck(g.mutex);
+        size_t n = std::min(batch, g.nodes.size());
+        c.nodes.insert(c.nodes.end(), g.nodes.end() - n, g.nodes.end());
+        g.nodes.resize(g.nodes.size() - n);
+    }
+    if (c.nodes.empty())
+        return new TaskNode();
+    TaskNode *node = c.nodes.back();
+    c.nodes.pop_back();
+    return node;
+}
+
+void ckf::TaskNodePool::free(TaskNode *node)
+{
+    Cache &c = cache();
+    c.nodes.push_back(node);
+    if (c.nodes.size() <= cache_max)
+        return;
+
+    // 缓存满：一批归还全局空闲表
+    Global &g = global();
+    std::unique_lock<std::mutex> lck(g.mutex);
+    while (c.nodes.size() > cache_max - batch)
+    {
+        if (g.nodes.size() < global_max)
+            g.nodes.push_back(c.nodes.back());
+        else
+            delete c.nodes.back();
+        c.nodes.pop_back();
+    }
+}
+
+// WorkDeque
+ckf::WorkDeque::WorkDeque()
+    : _top(0), _bottom(0)
+{
+    for (int64_t i = 0; i < capacity; i++)
+        _buffer[i].store(nullptr, std::memory_order_relaxed);
+}
+
+bool ckf::WorkDeque::push(Item item)
+{
+    int64_t b = _bottom.load(std::memory_order_relaxed);
+    int64_t t = _top.load(std::memory_order_acquire);
+    if (b - t >= capacity)
+        return false;
+    _buffer[b & mask].store(item, std::memory_order_relaxed);
+    _bottom.store(b + 1, std::memory_order_release); // 与steal对_bottom的acquire配对，窃取者能看到节点的内容
+    return true;
+}
+
+ckf::WorkDeque::Item ckf::WorkDeque::pop()
+{
+    // 先占住最后一个位置，再看是否与窃取者争夺同一个元素
+    int64_t b = _bottom.load(std::memory_order_relaxed) - 1;
+    _bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = _top.load(std::memory_order_relaxed);
+
+    Item item = nullptr;
+    if (t <= b)
+    {
+        item = _buffer[b & mask].load(std::memory_order_relaxed);
+        if (t == b)
+        {
+            // 只剩一个元素：与窃取者竞争top
+            if (!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                item = nullptr;
+            _bottom.store(b + 1, std::memory_order_relaxed);
+        }
+    }
+    else
+        _bottom.store(b + 1, std::memory_order_relaxed);
+    return item;
+}
+
+ckf::WorkDeque::Item ckf::WorkDeque::steal()
+{
+    int64_t t = _top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = _bottom.load(std::memory_order_acquire);
+    if (t >= b)
+        return nullptr;
+
+    Item item = _buffer[t & mask].load(std::memory_order_relaxed);
+    if (!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        return nullptr; // 被其它窃取者或所有者抢先
+    return item;
+}
+
+bool ckf::WorkDeque::empty() const
+{
+    return _bottom.load(std::memory_order_relaxed) <= _top.load(std::memory_order_relaxed);
+}
+
+// ThreadPool
+thread_local ckf::ThreadPool *ckf::ThreadPool::_tl_pool = nullptr;
+thread_local size_t ckf::ThreadPool::_tl_index = 0;
+
+ckf::ThreadPool &ckf::ThreadPool::getInstance(Executor which) // C++11之后的单例模式
+{
+    switch (which)
+    {
+    case IO:
+    {
+        static ThreadPool io("io");
+        return io;
+    }
+    case CPU:
+    {
+        static ThreadPool cpu("cpu");
+        return cpu;
+    }
+    default:
+    {
+        static ThreadPool background("background");
+        return background;
+    }
+    }
+}
+
+ckf::ThreadPool::ThreadPool(const std::string &name)
+    : _name(name), _conf(Cloud::Config::getInstance()->getExecutor(name)), _pending(0), _sleepers(0), _active(0), _threads(0), _isRunning(false), _accepting(false), _drop_above(LV3),
+      _dropped(Cloud::Metrics::getInstance().counter("cloud_pool_dropped_total", "Tasks dropped because they were cancelled or the pool stopped",
+                                                     Cloud::Metrics::label("executor", name)))
+{
+    for (auto &b : _backlog)
+        b = 0;
+
+    Cloud::Metrics &m = Cloud::Metrics::getInstance();
+    std::string executor = Cloud::Metrics::label("executor", _name);
+    static const char *priorities[priority_num] = {"LV1", "LV2", "LV3"};
+    for (size_t p = 0; p < priority_num; p++)
+        m.gauge("cloud_pool_backlog", "Tasks queued per priority", [this, p]()
+                { return (double)_backlog[p].load(); }, executor + "," + Cloud::Metrics::label("priority", priorities[p]));
+    m.gauge("cloud_pool_active", "Tasks currently running", [this]()
+            { return (double)_active.load(); }, executor);
+    m.gauge("cloud_pool_threads", "Worker threads", [this]()
+            { return (double)size(); }, executor);
     start();
 }
 
 ckf::ThreadPool::~ThreadPool()
 {
     if (_isRunning)
-    {
         this->stop();
-        std::cout << "线程池停止工作" << std::endl;
-    }
 }
 
 void ckf::ThreadPool::start()
 {
     // 线程池开始运行
     _isRunning = true;
-    // 初始化工作线程组
-    for (int i = 0; i < thread_num; i++)
+    _accepting = true;
+    _drop_above = LV3;
+    // 初始化工作线程组：先建好全部队列，再启动线程（线程启动后就可能窃取其它线程的队列）
+    size_t n = _conf.threads;
+    if (n == 0)
     {
-        std::thread *thr = new std::thread(&ckf::ThreadPool::threadLoop, this);
-        _threads.push_back(thr);
+        double cores = std::max(1u, std::thread::hardware_concurrency());
+        if (_name == "background")
+            cores *= Cloud::Config::getInstance()->getCompressCpu();
+        n = std::max<size_t>(1, (size_t)std::ceil(cores));
     }
+    for (size_t i = 0; i < n; i++)
+        _workers.emplace_back(new Worker(Cloud::Metrics::label("executor", _name) + "," +
+                                         Cloud::Metrics::label("worker", std::to_string(i))));
+    for (size_t i = 0; i < n; i++)
+        _workers[i]->thread = std::thread(&ckf::ThreadPool::threadLoop, this, i);
+    _threads = n;
+}
+
+size_t ckf::ThreadPool::size() const
+{
+    return _threads.load();
+}
+
+const std::string &ckf::ThreadPool::name() const
+{
+    return _name;
+}
+
+const std::vector<double> &ckf::ThreadPool::latencyBounds()
+{
+    static const std::vector<double> bounds = {0.00001, 0.00005, 0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10};
+    return bounds;
+}
+
+ckf::ThreadPool::Stats ckf::ThreadPool::stats() const
+{
+    Stats st;
+    st.threads = _threads.load();
+    st.active = _active.load();
+    st.sleepers = _sleepers.load();
+    for (size_t p = 0; p < priority_num; p++)
+        st.backlog[p] = _backlog[p].load();
+    st.dropped = _dropped.value();
+    st.wait_buckets.assign(latencyBounds().size() + 1, 0);
+    st.run_buckets.assign(latencyBounds().size() + 1, 0);
+
+    // 各工作线程的直方图按桶相加
+    std::vector<uint64_t> buckets;
+    double sum;
+    uint64_t count;
+    for (auto &w : _workers)
+    {
+        st.executed.push_back(w->executed.value());
+        st.steals += w->steals.value();
+        w->wait.snapshot(&buckets, &sum, &count);
+        for (size_t i = 0; i < buckets.size(); i++)
+            st.wait_buckets[i] += buckets[i];
+        st.wait_sum += sum;
+        w->run.snapshot(&buckets, &sum, &count);
+        for (size_t i = 0; i < buckets.size(); i++)
+            st.run_buckets[i] += buckets[i];
+        st.run_sum += sum;
+    }
+    return st;
+}
+
+bool ckf::ThreadPool::shutdown(std::chrono::milliseconds timeout, TaskPriority keep)
+{
+    if (!_isRunning)
+        return true;
+
+    // 1.拒绝新任务，之后排队的低优先级任务在取出时丢弃
+    _accepting = false;
+    _drop_above = keep;
+    _cond.notify_all();
+
+    // 2.等待排队和正在执行的任务完成
+    bool drained;
+    {
+        std::unique_lock<std::mutex> lockguard(_mutex);
+        drained = _idle_cond.wait_for(lockguard, timeout, [this]()
+                                      { return _pending.load() == 0 && _active.load() == 0; });
+    }
+
+    // 3.停止工作线程
+    stop();
+    return drained;
 }
 
 void ckf::ThreadPool::stop()
 {
-    _isRunning = false;
+    {
+        std::unique_lock<std::mutex> lockguard(_mutex);
+        _isRunning = false;
+        _accepting = false;
+    }
     _cond.notify_all(); // 通知所有线程，不再等待
     // 等待工作线程的任务都执行完
-    for (auto thr : _threads)
+    for (auto &w : _workers)
+        w->thread.join();
+
+    // 尚未执行的任务直接丢弃（对应的future得到broken_promise）
+    auto discard = [this](TaskNode *node)
+    {
+        _backlog[node->priority].fetch_sub(1, std::memory_order_relaxed);
+        _pending.fetch_sub(1);
+        _dropped.inc();
+        node->task.reset();
+        node->token = CancelToken();
+        TaskNodePool::free(node);
+    };
+    for (auto &w : _workers)
     {
-        thr->join();
-        delete thr;
+        while (TaskNode *node = w->deque.pop())
+            discard(node);
     }
-    _threads.clear();
+    {
+        // push在锁内检查_accepting后才放入全局队列：此后不会再有任务进入
+        std::unique_lock<std::mutex> lockguard(_mutex);
+        for (auto &q : _inject)
+        {
+            for (TaskNode *node : q)
+                discard(node);
+            q.clear();
+        }
+    }
+    _threads = 0;
+    _workers.clear();
 }
 
-void ckf::ThreadPool::threadLoop()
+bool ckf::ThreadPool::push(TaskPriority priLevel, const CancelToken &token, Task &&task)
 {
-    // 工作线程不断地从任务队列中取出任务，若队列为空，则阻塞等待
-    while (_isRunning)
+    if (!_accepting)
+        return false; // task析构，submit的future得到broken_promise
+
+    TaskNode *node = TaskNodePool::alloc();
+    node->task = std::move(task);
+    node->priority = priLevel;
+    node->token = token;
+    node->enqueued = std::chrono::steady_clock::now();
+
+    // 放入队列之前计数：任务被取出时计数一定已经加上
+    _backlog[priLevel].fetch_add(1, std::memory_order_relaxed);
+    _pending.fetch_add(1);
+
+    // 工作线程提交的任务（通常是当前任务拆出的子任务）放入自己的队列，满了再放全局队列
+    // 工作线程的队列在stop中join之后才清空，不会遗漏；全局队列在锁内再检查一次，与stop的清空互斥
+    if (_tl_pool != this || !_workers[_tl_index]->deque.push(node))
     {
-        Task task = take();
-        if (task)
+        std::unique_lock<std::mutex> lockguard(_mutex);
+        if (!_accepting)
         {
-            std::cout << "线程id: " << std::this_thread::get_id() << " 获取到任务";
-            task();
+            _backlog[priLevel].fetch_sub(1, std::memory_order_relaxed);
+            _pending.fetch_sub(1);
+            _idle_cond.notify_all(); // 计数曾短暂不为0，shutdown可能因此错过了最后一个任务结束时的通知
+            lockguard.unlock();
+            node->task.reset();
+            node->token = CancelToken();
+            TaskNodePool::free(node);
+            return false;
         }
+        _inject[priLevel].push_back(node);
+    }
+
+    // 先计数再看有没有休眠的线程；休眠前在锁内检查计数，两边至少有一方看到对方，不会丢失唤醒
+    if (_sleepers.load() > 0)
+    {
+        std::unique_lock<std::mutex> lockguard(_mutex);
+        _cond.notify_one();
     }
-    std::cout << "线程id: " << std::this_thread::get_id() << " 退出";
+    return true;
 }
 
-ckf::ThreadPool::Task ckf::ThreadPool::take() // 从任务队列中取出任务
+ckf::TaskNode *ckf::ThreadPool::take(size_t self)
 {
-    // 1.加锁保护
-    std::unique_lock<std::mutex> lockguard(_mutex);
+    // 1.自己的队列
+    TaskNode *task = _workers[self]->deque.pop();
 
-    // 2.如果任务队列为空，阻塞等待
-    while (_isRunning && _task_queue.empty())
+    // 2.全局队列，高优先级先取
+    if (!task)
     {
-        _cond.wait(lockguard);
+        std::unique_lock<std::mutex> lockguard(_mutex);
+        for (auto &q : _inject)
+        {
+            if (!q.empty())
+            {
+                task = q.front();
+                q.pop_front();
+                break;
+            }
+        }
     }
 
-    // 3.线程被唤醒，阻塞等待结束，此时有两种情况
-    // (1)任务队列里新增任务
-    // (2)线程池stop了, 如果任务队列里还有任务，则将其取出，进行最后的工作
-    // 基于情况(2)，此时任务队列中还不一定有任务，因此要判断一下
+    // 3.从其它工作线程的队列顶部窃取，从下一个线程开始轮询，分散窃取者
+    for (size_t i = 1; !task && i < _workers.size(); i++)
+    {
+        task = _workers[(self + i) % _workers.size()]->deque.steal();
+        if (task)
+            _workers[self]->steals.inc();
+    }
 
-    Task task;
-    if (!_task_queue.empty())
+    if (task)
     {
-        task = _task_queue.top().second;
-        _task_queue.pop();
+        _backlog[task->priority].fetch_sub(1, std::memory_order_relaxed);
+        // 先计入正在执行，再减少排队数：停止时等待的二者之和不会短暂为0
+        _active.fetch_add(1);
+        _pending.fetch_sub(1);
     }
     return task;
 }
 
-template <typename F, typename... Args>
-auto ckf::ThreadPool::submit(const TaskPriority &priLevel, F &&f, Args &&...args)
-    -> std::future<decltype(f(args...))>
+bool ckf::ThreadPool::wait()
+{
+    std::unique_lock<std::mutex> lockguard(_mutex);
+    _sleepers.fetch_add(1);
+    _cond.wait(lockguard, [this]()
+               { return !_isRunning || _pending.load() > 0; });
+    _sleepers.fetch_sub(1);
+    return _isRunning;
+}
+
+void ckf::ThreadPool::threadLoop(size_t self)
+{
+    _tl_pool = this;
+    _tl_index = self;
+    setupThread(self);
+
+    // 工作线程不断地取出任务执行，所有队列都为空时阻塞等待
+    Worker &w = *_workers[self];
+    while (_isRunning)
+    {
+        TaskNode *node = take(self);
+        if (!node)
+        {
+            // 窃取可能因竞争失败而漏掉任务：_pending不为0时wait立即返回，重新尝试
+            if (!wait())
+                break;
+            continue;
+        }
+        if (!dropped(node))
+        {
+            auto start = std::chrono::steady_clock::now();
+            node->task();
+            auto end = std::chrono::steady_clock::now();
+            w.wait.observe(std::chrono::duration<double>(start - node->enqueued).count());
+            w.run.observe(std::chrono::duration<double>(end - start).count());
+            w.executed.inc();
+        }
+        else
+            _dropped.inc();
+        node->task.reset(); // 捕获的对象在归还节点之前释放
+        node->token = CancelToken();
+        TaskNodePool::free(node);
+
+        if (_active.fetch_sub(1) == 1 && !_accepting && _pending.load() == 0)
+        {
+            std::unique_lock<std::mutex> lockguard(_mutex); // 与shutdown的检查互斥，不会丢失通知
+            _idle_cond.notify_all();
+        }
+    }
+}
+
+ckf::ThreadPool::Worker::Worker(const std::string &labels)
+    : executed(Cloud::Metrics::getInstance().counter("cloud_pool_tasks_total", "Tasks executed per worker", labels)),
+      steals(Cloud::Metrics::getInstance().counter("cloud_pool_steals_total", "Tasks stolen from other workers' queues", labels)),
+      wait(Cloud::Metrics::getInstance().histogram("cloud_pool_queue_wait_seconds", "Time from submit to start of execution",
+                                                   latencyBounds(), labels)),
+      run(Cloud::Metrics::getInstance().histogram("cloud_pool_run_seconds", "Task execution time", latencyBounds(), labels))
 {
-    using RetType = decltype(f(args...)); // 返回类型
+}
 
-    std::function<RetType()> func = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
+void ckf::ThreadPool::setupThread(size_t self)
+{
+    // 线程名（最长15字节）便于在top -H、perf中区分执行器
+    std::string tname = (_name + "-" + std::to_string(self)).substr(0, 15);
+    pthread_setname_np(pthread_self(), tname.c_str());
 
-    auto task_ptr = std::make_shared<std::packaged_task<RetType()>>(func);
-    // std::packaged_task<RetType()> ptask(func);//err
+    if (_conf.nice != 0 && setpriority(PRIO_PROCESS, syscall(SYS_gettid), _conf.nice) != 0)
+        _logger->_warn("执行器%s设置调度优先级失败: %s", _name.c_str(), strerror(errno));
 
-    Task task = [task_ptr]()
+    if (!_conf.cpus.empty())
     {
-        (*task_ptr)();
-    };
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int c : _conf.cpus)
+            CPU_SET(c, &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0)
+            _logger->_warn("执行器%s绑定CPU失败: %s", _name.c_str(), strerror(err));
+    }
+}
 
-    // 对于lambda赋值给std::function，后者会拷贝捕获的变量(值传递)。如果这些变量是局部变量，
-    // 并且它们没有在 std::function 之外的地方存活下来，那么超出作用域后，这些拷贝的对象也会销毁。
+bool ckf::ThreadPool::dropped(const TaskNode *node) const
+{
+    return node->token.cancelled() || node->priority > _drop_above.load();
+}
 
-    std::unique_lock<std::mutex> lockguard(_mutex);
-    TaskPair taskPair(priLevel, task);
-    _task_queue.push(taskPair);
-    _cond.notify_one();
+template <typename F, typename... Args, typename>
+auto ckf::ThreadPool::submit(const TaskPriority &priLevel, F &&f, Args &&...args)
+    -> std::future<ResultOf<F, Args...>>
+{
+    return submit(priLevel, CancelToken(), std::forward<F>(f), std::forward<Args>(args)...);
+}
 
-    return task_ptr->get_future();
-}
\ No newline at end of file
+template <typename F, typename... Args>
+auto ckf::ThreadPool::submit(const TaskPriority &priLevel, const CancelToken &token, F &&f, Args &&...args)
+    -> std::future<ResultOf<F, Args...>>
+{
+    using RetType = ResultOf<F, Args...>; // 返回类型
+
+    // 参数按值移入lambda，packaged_task本身只有一个指向共享状态的指针，整体放得进Task的内部存储
+    // 只有future的共享状态需要一次分配
+    std::packaged_task<RetType()> ptask(
+        [func = std::forward<F>(f), params = std::make_tuple(std::forward<Args>(args)...)]() mutable
+        { return std::apply(std::move(func), std::move(params)); });
+    std::future<RetType> result = ptask.get_future();
+    push(priLevel, token, Task(std::move(ptask)));
+    return result;
+}
+
+template <typename F, typename... Args, typename>
+bool ckf::ThreadPool::post(const TaskPriority &priLevel, F &&f, Args &&...args)
+{
+    return post(priLevel, CancelToken(), std::forward<F>(f), std::forward<Args>(args)...);
+}
+
+template <typename F, typename... Args>
+bool ckf::ThreadPool::post(const TaskPriority &priLevel, const CancelToken &token, F &&f, Args &&...args)
+{
+    // 不创建future：小任务提交时不分配内存（节点来自TaskNodePool，可调用对象存放在Task内部）
+    return push(priLevel, token, Task([func = std::forward<F>(f), params = std::make_tuple(std::forward<Args>(args)...)]() mutable
+                                      { std::apply(std::move(func), std::move(params)); }));
+}
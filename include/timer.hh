@@ -0,0 +1,188 @@
+#pragma once
+#include <queue>
+#include <mutex>
+#include <unordered_map>
+#include <memory>
+#include <string_view>
+#include <sys/eventfd.h>
+#include "util.hh"
+
+namespace Cloud
+{
+    // 冷却时刻调度器：(deadline, 相对路径)最小堆
+    // 相对路径不拷贝：Key是指向记录自身rel_path的别名共享指针，持有记录本身，表的key是指向它的string_view
+    // 同一个相对路径重复调度时只更新表中的时刻，堆中的旧项在弹出时按表比对丢弃（惰性删除），
+    // 旧项过多时整体重建堆，堆的大小与被调度的文件数同阶
+    // 最早时刻提前时eventfd变为可读，消费者可以与其它fd一起poll，只在最早时刻到达时醒来
+    class DeadlineScheduler
+    {
+    public:
+        using Key = std::shared_ptr<const std::string>; // 记录中的相对路径
+
+        DeadlineScheduler();
+        ~DeadlineScheduler();
+
+        template <typename Record>
+        static Key keyOf(const std::shared_ptr<const Record> &record); // 记录 -> 指向其rel_path的Key，不分配内存
+
+        void schedule(const Key &rel, time_t deadline);        // 加入或更新冷却时刻
+        void postpone(std::string_view rel, time_t deadline);  // 推迟已调度的相对路径：没有调度或已更晚时不变
+        void cancel(std::string_view rel);                     // 取消（已压缩、正在压缩或已删除）
+        size_t popExpired(time_t now, std::vector<Key> *rels); // 取出所有已到期的相对路径
+        time_t nextDeadline();                                 // 最早的冷却时刻，没有时返回0
+        size_t size();                                         // 被调度的文件数
+        int fd() const;                                        // 用于poll的eventfd，读出即清零
+
+    private:
+        void notify();  // 唤醒poll在fd上的消费者
+        void rebuild(); // 丢弃堆中的旧项（调用者持有_mutex）
+
+    private:
+        struct Deadline // (冷却时刻, 相对路径)，只按时刻排序
+        {
+            time_t when;
+            Key rel;
+            bool operator>(const Deadline &other) const { return when > other.when; }
+        };
+        struct Entry // 相对路径的最新调度
+        {
+            time_t when;
+            Key rel; // 表的key指向*rel
+        };
+
+        std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline>> _heap;
+        std::unordered_map<std::string_view, Entry> _deadlines; // 相对路径 -> 最新的冷却时刻
+        std::mutex _mutex;
+        int _event_fd;
+    };
+}
+
+Cloud::DeadlineScheduler::DeadlineScheduler()
+    : _event_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+{
+    if (_event_fd < 0)
+        DF_ERROR("eventfd create failed");
+}
+
+Cloud::DeadlineScheduler::~DeadlineScheduler()
+{
+    if (_event_fd >= 0)
+        ::close(_event_fd);
+}
+
+template <typename Record>
+Cloud::DeadlineScheduler::Key Cloud::DeadlineScheduler::keyOf(const std::shared_ptr<const Record> &record)
+{
+    return Key(record, &record->rel_path);
+}
+
+void Cloud::DeadlineScheduler::schedule(const Key &rel, time_t deadline)
+{
+    bool earlier = false;
+    {
+        std::unique_lock<std::mutex> lck(_mutex);
+        auto it = _deadlines.find(*rel);
+        if (it == _deadlines.end())
+            _deadlines.emplace(*rel, Entry{deadline, rel});
+        else
+        {
+            if (it->second.when == deadline)
+                return;
+            // 记录被整体替换过：表项改为指向新记录的相对路径，旧记录随堆中的旧项一起释放
+            if (it->second.rel != rel)
+            {
+                auto node = _deadlines.extract(it);
+                node.key() = *rel;
+                node.mapped().rel = rel;
+                it = _deadlines.insert(std::move(node)).position;
+            }
+            it->second.when = deadline;
+        }
+        earlier = _heap.empty() || deadline < _heap.top().when;
+        _heap.push({deadline, rel});
+        if (_heap.size() > 2 * _deadlines.size() + 1024)
+            rebuild();
+    }
+    if (earlier)
+        notify();
+}
+
+void Cloud::DeadlineScheduler::postpone(std::string_view rel, time_t deadline)
+{
+    // 只会推迟，不会提前最早时刻，不需要唤醒消费者；沿用已调度的Key，
+    // 调用者手中的记录可能是后端查出的副本，与调度时的不是同一个对象
+    std::unique_lock<std::mutex> lck(_mutex);
+    auto it = _deadlines.find(rel);
+    if (it == _deadlines.end() || it->second.when >= deadline)
+        return;
+    it->second.when = deadline;
+    _heap.push({deadline, it->second.rel});
+    if (_heap.size() > 2 * _deadlines.size() + 1024)
+        rebuild();
+}
+
+void Cloud::DeadlineScheduler::cancel(std::string_view rel)
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    _deadlines.erase(rel); // 堆中的项弹出时丢弃
+}
+
+size_t Cloud::DeadlineScheduler::popExpired(time_t now, std::vector<Key> *rels)
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    size_t n = 0;
+    while (!_heap.empty() && _heap.top().when <= now)
+    {
+        Deadline d = std::move(const_cast<Deadline &>(_heap.top()));
+        _heap.pop();
+
+        auto it = _deadlines.find(*d.rel);
+        if (it == _deadlines.end() || it->second.when != d.when)
+            continue; // 已取消，或之后又被调度过
+        rels->push_back(std::move(it->second.rel));
+        _deadlines.erase(it);
+        n++;
+    }
+    return n;
+}
+
+time_t Cloud::DeadlineScheduler::nextDeadline()
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    // 顺便丢弃堆顶的旧项，让返回值就是真正的最早时刻
+    while (!_heap.empty())
+    {
+        auto it = _deadlines.find(*_heap.top().rel);
+        if (it != _deadlines.end() && it->second.when == _heap.top().when)
+            return _heap.top().when;
+        _heap.pop();
+    }
+    return 0;
+}
+
+size_t Cloud::DeadlineScheduler::size()
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    return _deadlines.size();
+}
+
+int Cloud::DeadlineScheduler::fd() const
+{
+    return _event_fd;
+}
+
+void Cloud::DeadlineScheduler::notify()
+{
+    uint64_t one = 1;
+    if (_event_fd >= 0)
+        (void)::write(_event_fd, &one, sizeof(one));
+}
+
+void Cloud::DeadlineScheduler::rebuild()
+{
+    std::vector<Deadline> live;
+    live.reserve(_deadlines.size());
+    for (auto &[rel, entry] : _deadlines)
+        live.push_back({entry.when, entry.rel});
+    _heap = decltype(_heap)(std::greater<Deadline>(), std::move(live));
+}
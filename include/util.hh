@@ -8,6 +8,8 @@
 #include <experimental/filesystem>
 #include <pthread.h>
 #include <cassert>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "jsoncpp/json/json.h"
 #include "bundle.h"
@@ -31,9 +33,7 @@ namespace Util
         bool getContent(std::string &content);                        // 获取文件内容
         bool getPosLen(std::string &content, size_t pos, size_t len); // 获取文件的部分内容
         bool setContent(const std::string &content);                  // 设置文件内容
-
-        bool compress(const std::string &packname);   // 压缩
-        bool uncompress(const std::string &filename); // 解压
+        bool atomicSetContent(const std::string &content);            // 原子地替换文件内容（临时文件 + fsync + rename）
 
         bool isExists();                                     // 判断文件是否存在
         bool createDirectory();                              // 创建目录
@@ -50,7 +50,7 @@ namespace Util
     class JsonUtil
     {
     public:
-        static bool serialize(const Json::Value &root, std::string *str);
+        static bool serialize(const Json::Value &root, std::string *str, bool compact = false);
         static bool unserialize(const std::string &str, Json::Value *root);
     };
 
@@ -64,7 +64,7 @@ namespace Util
         }
         ~RDLockGuard()
         {
-            pthread_rwlock_destroy(_rdlock);
+            pthread_rwlock_unlock(_rdlock);
         }
 
     private:
@@ -77,11 +77,11 @@ namespace Util
         WRLockGuard(pthread_rwlock_t *wrlock)
             : _wrlock(wrlock)
         {
-            pthread_rwlock_rdlock(_wrlock);
+            pthread_rwlock_wrlock(_wrlock);
         }
         ~WRLockGuard()
         {
-            pthread_rwlock_destroy(_wrlock);
+            pthread_rwlock_unlock(_wrlock);
         }
 
     private:
@@ -195,64 +195,53 @@ bool Util::FileUtil::setContent(const std::string &content)
     return true;
 }
 
-bool Util::FileUtil::compress(const std::string &packname)
+bool Util::FileUtil::atomicSetContent(const std::string &content)
 {
-    // 压缩当前文件的内容
-    std::string cont;
-    if (!getContent(cont))
+    // 先写临时文件并刷盘，再rename覆盖原文件，崩溃时只会看到旧内容或新内容
+    std::string tmp = _path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
     {
-        DF_WARN("%s: Get file content failed", _path.c_str());
+        DF_WARN("%s: File open fail", tmp.c_str());
         return false;
     }
-    std::string packed = bundle::pack(bundle::LZIP, cont);
 
-    // 打开压缩包文件
-    std::ofstream ofs(packname, std::ios::binary);
-    if (!ofs.is_open())
+    size_t written = 0;
+    while (written < content.size())
     {
-        DF_WARN("%s: File open fail", _path.c_str());
-        return false;
+        ssize_t n = ::write(fd, content.data() + written, content.size() - written);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            DF_WARN("%s: Write file failed", tmp.c_str());
+            ::close(fd);
+            return false;
+        }
+        written += n;
     }
-
-    // 写入压缩包文件
-    ofs.write(packed.c_str(), packed.size());
-    if (!ofs.good())
+    if (::fsync(fd) < 0)
     {
-        DF_WARN("%s: Write file failed", _path.c_str());
-        ofs.close();
+        DF_WARN("%s: Fsync file failed", tmp.c_str());
+        ::close(fd);
         return false;
     }
-    ofs.close();
-
-    return true;
-}
+    ::close(fd);
 
-bool Util::FileUtil::uncompress(const std::string &filename)
-{
-    std::string cont;
-    if (!getContent(cont))
-    {
-        DF_WARN("Get file content failed");
-        return false;
-    }
-    std::string unpacked = bundle::unpack(cont);
-
-    std::ofstream ofs(filename, std::ios::binary);
-    if (!ofs.is_open())
+    if (::rename(tmp.c_str(), _path.c_str()) < 0)
     {
-        DF_WARN("%s: File open fail", _path.c_str());
+        DF_WARN("%s: Rename file failed", _path.c_str());
         return false;
     }
 
-    ofs.write(unpacked.c_str(), unpacked.size());
-    if (!ofs.good())
+    // rename本身也要落盘：同步所在目录
+    fs::path parent = fs::path(_path).parent_path();
+    int dirfd = ::open(parent.empty() ? "." : parent.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dirfd >= 0)
     {
-        DF_WARN("%s: Write file failed", _path.c_str());
-        ofs.close();
-        return false;
+        ::fsync(dirfd);
+        ::close(dirfd);
     }
-    ofs.close();
-
     return true;
 }
 
@@ -281,9 +270,11 @@ bool Util::FileUtil::remove()
     return fs::remove(_path);
 }
 
-bool Util::JsonUtil::serialize(const Json::Value &root, std::string *str)
+bool Util::JsonUtil::serialize(const Json::Value &root, std::string *str, bool compact)
 {
     Json::StreamWriterBuilder swb;
+    if (compact)
+        swb["indentation"] = ""; // 单行输出
 
     std::unique_ptr<Json::StreamWriter> writer(swb.newStreamWriter());
 
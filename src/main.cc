@@ -4,22 +4,12 @@
 #include "log/ckflog.hpp"
 #include <thread>
 #include <memory>
+#include <chrono>
+#include <signal.h>
 
 Cloud::BackupInfoManager* _biManager;
 ckflogs::Logger::Ptr _logger;
 
-void hotModuleHandler()//热点管理模块
-{
-    Cloud::HotManager hotManager;
-    hotManager.run();
-}
-
-void serviceModuleHandler()//业务处理模块
-{
-    Cloud::Service service;
-    service.run();
-}
-
 void loggerBuild()
 {
     ckflogs::LoggerBuilder::Ptr builder = std::make_shared<ckflogs::GlobalLoggerBuilder>();
@@ -34,14 +24,42 @@ int main()
 {
     loggerBuild();
 
+    // 在创建任何线程之前屏蔽SIGTERM/SIGINT，由主线程sigwait同步处理，其余线程继承屏蔽字不会被打断
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
+
     _biManager = new Cloud::BackupInfoManager; //备份文件信息管理模块
 
-    std::thread hot(hotModuleHandler);
-    std::thread service(serviceModuleHandler);
-    
+    Cloud::HotManager hotManager;
+    Cloud::Service service;
+    std::thread hot([&hotManager]() { hotManager.run(); });       //热点管理模块
+    std::thread serviceThread([&service]() { service.run(); });  //业务处理模块
+
+    int sig = 0;
+    sigwait(&sigs, &sig);
+    _logger->_info("收到信号%d，开始停止", sig);
+
+    // 按依赖顺序停止：先不再接收请求、不再产生压缩，再排空压缩和线程池，最后把元信息落盘
+    std::chrono::milliseconds timeout(Cloud::Config::getInstance()->getShutdownTimeout() * 1000ULL);
+    service.stop();
+    serviceThread.join();
+    hotManager.stop();
     hot.join();
-    service.join();
+    if (!Cloud::Compressor::getInstance().shutdown(timeout))
+        _logger->_warn("压缩未在期限内全部完成，未完成的文件保持原样");
+    // 各执行器只保留LV1、LV2的任务：预先解压（LV3）直接丢弃，回收站清理（LV3）下次启动时recoverTrash会处理
+    // io最后停止，等待前面的执行器可能触发的元信息压实
+    for (auto which : {ckf::ThreadPool::CPU, ckf::ThreadPool::BACKGROUND, ckf::ThreadPool::IO})
+    {
+        ckf::ThreadPool &pool = ckf::ThreadPool::getInstance(which);
+        if (!pool.shutdown(timeout, ckf::ThreadPool::LV2))
+            _logger->_warn("执行器%s未在期限内排空", pool.name().c_str());
+    }
 
     delete _biManager;
+    _logger->_info("服务已停止");
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,330 @@
+// 线程池压力测试：WorkDeque的所有者/窃取者竞争、TaskNodePool的跨线程回收、休眠唤醒，
+// 以及submit/post/取消/shutdown的基本行为
+// 在test目录下运行（配置文件路径为../config/cloud.conf）：make test
+#include "threadpool.hh"
+#include <set>
+#include <random>
+
+ckflogs::Logger::Ptr _logger;
+
+static std::atomic<int> failures(0);
+
+#define CHECK(cond)                                                          \
+    do                                                                       \
+    {                                                                        \
+        if (!(cond))                                                         \
+        {                                                                    \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                      \
+        }                                                                    \
+    } while (0)
+
+static void loggerBuild()
+{
+    ckflogs::LoggerBuilder::Ptr builder = std::make_shared<ckflogs::GlobalLoggerBuilder>();
+    builder->buildSinker<ckflogs::FileLogSinker>("./threadpool_test.log");
+    builder->bulidType(ckflogs::Logger::LoggerType::LOGGER_SYNC);
+    builder->bulidName("CloudLogger");
+    builder->build();
+    _logger = ckflogs::getLogger("CloudLogger");
+}
+
+template <typename T>
+static bool ready(std::future<T> &f, int ms = 5000)
+{
+    return f.wait_for(std::chrono::milliseconds(ms)) == std::future_status::ready;
+}
+
+// 1.一个所有者随机地压入、弹出，多个窃取者同时窃取：每个元素恰好被取出一次
+static void testDeque()
+{
+    const size_t items = 200000, stealers = 4;
+    std::vector<ckf::TaskNode> nodes(items);
+    std::unique_ptr<std::atomic<uint8_t>[]> seen(new std::atomic<uint8_t>[items]);
+    for (size_t i = 0; i < items; i++)
+        seen[i] = 0;
+    auto take = [&](ckf::TaskNode *node)
+    {
+        seen[node - nodes.data()].fetch_add(1);
+    };
+
+    ckf::WorkDeque deque;
+    std::atomic<bool> done(false);
+    std::atomic<size_t> stolen(0);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < stealers; t++)
+    {
+        threads.emplace_back([&]()
+        {
+            while (true)
+            {
+                bool finished = done.load(); // 先读标志：此后仍为空才说明所有者已不再压入
+                if (ckf::TaskNode *node = deque.steal())
+                {
+                    take(node);
+                    stolen++;
+                }
+                else if (finished && deque.empty())
+                    break;
+                else
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    std::mt19937 rng(12345);
+    size_t next = 0;
+    while (next < items)
+    {
+        // 一批压入（满了就停），再弹出随机个数；一半的批次只压入一个，集中制造只剩一个元素时与窃取者的竞争
+        size_t burst = rng() % 2 ? 1 : rng() % 64 + 1;
+        for (size_t i = 0; i < burst && next < items; i++)
+        {
+            if (!deque.push(&nodes[next]))
+                break;
+            next++;
+        }
+        size_t pops = rng() % 64;
+        for (size_t i = 0; i < pops; i++)
+        {
+            ckf::TaskNode *node = deque.pop();
+            if (!node)
+                break;
+            take(node);
+        }
+    }
+    while (ckf::TaskNode *node = deque.pop())
+        take(node);
+    done = true;
+    for (auto &thr : threads)
+        thr.join();
+
+    size_t once = 0;
+    for (size_t i = 0; i < items; i++)
+        once += seen[i].load() == 1;
+    CHECK(once == items);
+    CHECK(deque.empty());
+    fprintf(stderr, "deque: %zu items, %zu stolen\n", items, stolen.load());
+}
+
+// 2.节点在不同线程之间分配、释放：同一个节点不会同时被分配两次
+static void testNodePool()
+{
+    const size_t threads_num = 4, rounds = 200000;
+    std::mutex mutex;
+    std::set<ckf::TaskNode *> inUse;
+    std::atomic<size_t> duplicated(0);
+
+    // 每个线程分配一批节点交给下一个线程释放，节点在线程缓存和全局空闲表之间流动
+    std::vector<std::vector<ckf::TaskNode *>> handoff(threads_num);
+    std::vector<std::mutex> handoffMutex(threads_num);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < threads_num; t++)
+    {
+        threads.emplace_back([&, t]()
+        {
+            std::vector<ckf::TaskNode *> mine;
+            for (size_t r = 0; r < rounds; r++)
+            {
+                ckf::TaskNode *node = ckf::TaskNodePool::alloc();
+                {
+                    std::unique_lock<std::mutex> lck(mutex);
+                    if (!inUse.insert(node).second)
+                        duplicated++;
+                }
+                mine.push_back(node);
+                if (mine.size() == 100)
+                {
+                    std::unique_lock<std::mutex> lck(handoffMutex[(t + 1) % threads_num]);
+                    auto &q = handoff[(t + 1) % threads_num];
+                    q.insert(q.end(), mine.begin(), mine.end());
+                    mine.clear();
+                }
+
+                std::vector<ckf::TaskNode *> theirs;
+                {
+                    std::unique_lock<std::mutex> lck(handoffMutex[t]);
+                    theirs.swap(handoff[t]);
+                }
+                for (ckf::TaskNode *n : theirs)
+                {
+                    {
+                        std::unique_lock<std::mutex> lck(mutex);
+                        inUse.erase(n);
+                    }
+                    ckf::TaskNodePool::free(n);
+                }
+            }
+            for (ckf::TaskNode *n : mine)
+            {
+                {
+                    std::unique_lock<std::mutex> lck(mutex);
+                    inUse.erase(n);
+                }
+                ckf::TaskNodePool::free(n);
+            }
+        });
+    }
+    for (auto &thr : threads)
+        thr.join();
+    for (auto &q : handoff)
+    {
+        for (ckf::TaskNode *n : q)
+        {
+            inUse.erase(n);
+            ckf::TaskNodePool::free(n);
+        }
+    }
+    CHECK(duplicated == 0);
+    CHECK(inUse.empty());
+}
+
+// 3.唤醒：工作线程都休眠后再提交，任务必须在期限内执行（丢失唤醒会超时）；
+//   多个外部线程并发提交、任务中再提交子任务（进入工作线程自己的队列，被其它线程窃取）
+static void testWakeup(ckf::ThreadPool &pool)
+{
+    size_t lost = 0;
+    for (int round = 0; round < 200; round++)
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(round % 2 ? 2000 : 50));
+        auto f = pool.submit(ckf::ThreadPool::LV2, [](int x)
+                             { return x + 1; }, round);
+        if (!ready(f, 2000) || f.get() != round + 1)
+            lost++;
+    }
+    CHECK(lost == 0);
+
+    const size_t producers = 4, perProducer = 50000;
+    std::atomic<size_t> count(0);
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; p++)
+    {
+        threads.emplace_back([&]()
+        {
+            for (size_t i = 0; i < perProducer; i++)
+            {
+                // 每8个任务中有一个再拆出两个子任务
+                bool ok = pool.post((ckf::ThreadPool::TaskPriority)(i % 3), [&pool, &count, i]()
+                {
+                    count++;
+                    if (i % 8 == 0)
+                    {
+                        for (int k = 0; k < 2; k++)
+                            pool.post(ckf::ThreadPool::LV1, [&count]() { count++; });
+                    }
+                });
+                CHECK(ok);
+                if (i % 1000 == 0)
+                    std::this_thread::sleep_for(std::chrono::microseconds(100)); // 让工作线程有机会休眠
+            }
+        });
+    }
+    for (auto &thr : threads)
+        thr.join();
+
+    size_t expected = producers * (perProducer + (perProducer + 7) / 8 * 2);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while (count < expected && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    CHECK(count == expected);
+
+    ckf::ThreadPool::Stats st = pool.stats();
+    CHECK(st.backlog[0] + st.backlog[1] + st.backlog[2] == 0);
+    fprintf(stderr, "wakeup: %zu tasks, %lu steals\n", count.load(), (unsigned long)st.steals);
+}
+
+// 4.submit/post的结果与参数、取消、shutdown
+static void testSubmitAndShutdown(ckf::ThreadPool &pool)
+{
+    auto f = pool.submit(ckf::ThreadPool::LV1, [](std::unique_ptr<int> p, int k)
+                         { return *p * k; }, std::make_unique<int>(6), 7);
+    CHECK(ready(f) && f.get() == 42);
+
+    auto fe = pool.submit(ckf::ThreadPool::LV1, []() -> int
+                          { throw std::runtime_error("task failed"); });
+    bool thrown = false;
+    try
+    {
+        fe.get();
+    }
+    catch (const std::runtime_error &)
+    {
+        thrown = true;
+    }
+    CHECK(thrown);
+
+    // 占住所有工作线程，使后面的任务排队
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    for (size_t i = 0; i < pool.size(); i++)
+        pool.post(ckf::ThreadPool::LV1, [opened]() { opened.wait(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    std::atomic<int> kept(0), low(0), cancelled(0);
+    ckf::CancelToken token = ckf::CancelToken::create();
+    for (int i = 0; i < 100; i++)
+    {
+        pool.post(ckf::ThreadPool::LV2, [&kept]() { kept++; });
+        pool.post(ckf::ThreadPool::LV3, [&low]() { low++; });
+        pool.post(ckf::ThreadPool::LV1, token, [&cancelled]() { cancelled++; });
+    }
+    auto fc = pool.submit(ckf::ThreadPool::LV1, token, []() { return 1; });
+    token.cancel();
+
+    std::thread opener([&gate]()
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        gate.set_value();
+    });
+    bool drained = pool.shutdown(std::chrono::seconds(10), ckf::ThreadPool::LV2);
+    opener.join();
+
+    CHECK(drained);
+    CHECK(kept == 100);    // 不低于keep的任务执行完
+    CHECK(low == 0);       // 低优先级的排队任务丢弃
+    CHECK(cancelled == 0); // 已取消的任务不执行
+    bool broken = false;
+    try
+    {
+        fc.get();
+    }
+    catch (const std::future_error &e)
+    {
+        broken = e.code() == std::future_errc::broken_promise;
+    }
+    CHECK(broken);
+
+    // 停止后不再接受任务
+    CHECK(!pool.post(ckf::ThreadPool::LV1, []() {}));
+    auto fr = pool.submit(ckf::ThreadPool::LV1, []() { return 1; });
+    bool rejected = false;
+    try
+    {
+        fr.get();
+    }
+    catch (const std::future_error &)
+    {
+        rejected = true;
+    }
+    CHECK(rejected);
+    CHECK(pool.size() == 0);
+    CHECK(pool.stats().dropped >= 201);
+}
+
+int main()
+{
+    loggerBuild();
+
+    testDeque();
+    testNodePool();
+    testWakeup(ckf::ThreadPool::getInstance(ckf::ThreadPool::CPU));
+    testSubmitAndShutdown(ckf::ThreadPool::getInstance(ckf::ThreadPool::BACKGROUND));
+
+    if (failures > 0)
+    {
+        fprintf(stderr, "threadpool_test: %d check(s) failed\n", failures.load());
+        return 1;
+    }
+    fprintf(stderr, "threadpool_test: all passed\n");
+    return 0;
+}